@@ -40,6 +40,7 @@
 #endif
 
 
+#ifndef FC_CACHE_FAST_NAMES
 struct MD5Context {
         FcChar32 buf[4];
         FcChar32 bits[2];
@@ -50,8 +51,21 @@ static void MD5Init(struct MD5Context *ctx);
 static void MD5Update(struct MD5Context *ctx, const unsigned char *buf, unsigned len);
 static void MD5Final(unsigned char digest[16], struct MD5Context *ctx);
 static void MD5Transform(FcChar32 buf[4], FcChar32 in[16]);
+#endif
+
+/*
+ * Cache file names are a hash of the directory name followed by this
+ * tag.  Names from the fast hash carry a tag of their own, so they can
+ * never be mistaken for MD5 based names written by other builds
+ * sharing the cache directory.
+ */
+#ifdef FC_CACHE_FAST_NAMES
+#define FC_CACHE_NAME_TAG   "-" FC_ARCHITECTURE "-fh1" FC_CACHE_SUFFIX
+#else
+#define FC_CACHE_NAME_TAG   "-" FC_ARCHITECTURE FC_CACHE_SUFFIX
+#endif
 
-#define CACHEBASE_LEN (1 + 32 + 1 + sizeof (FC_ARCHITECTURE) + sizeof (FC_CACHE_SUFFIX))
+#define CACHEBASE_LEN (1 + 32 + sizeof (FC_CACHE_NAME_TAG))
 
 static FcBool
 FcCacheIsMmapSafe (int fd)
@@ -89,18 +103,105 @@ static const char bin2hex[] = { '0', '1', '2', '3',
 				'8', '9', 'a', 'b',
 				'c', 'd', 'e', 'f' };
 
+/*
+ * Quick string hash for lookups, not for file names
+ */
+static FcChar32
+FcDirCacheStrHash (const FcChar8 *s)
+{
+    FcChar32	h = 2166136261U;
+
+    while (*s)
+    {
+	h ^= *s++;
+	h *= 16777619U;
+    }
+    return h;
+}
+
+#ifdef FC_CACHE_FAST_NAMES
+static uint64_t
+FcDirCacheRotl (uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t
+FcDirCacheMix (uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/*
+ * 128-bit non-cryptographic hash modelled on MurmurHash3.  Input is
+ * read in little-endian order, so names do not depend on the host.
+ */
+static void
+FcDirCacheHashFast (const FcChar8 *dir, size_t len, unsigned char hash[16])
+{
+    const uint64_t  c1 = 0x87c37b91114253d5ULL;
+    const uint64_t  c2 = 0x4cf5ad432745937fULL;
+    uint64_t	    h1 = len, h2 = len, k1, k2;
+    size_t	    i, j, n;
+
+    for (i = 0; i < len; i += 16)
+    {
+	n = len - i < 16 ? len - i : 16;
+	k1 = k2 = 0;
+	for (j = 0; j < n && j < 8; j++)
+	    k1 |= (uint64_t) dir[i + j] << (8 * j);
+	for (; j < n; j++)
+	    k2 |= (uint64_t) dir[i + j] << (8 * (j - 8));
+
+	k1 *= c1;
+	k1 = FcDirCacheRotl (k1, 31);
+	k1 *= c2;
+	h1 ^= k1;
+	h1 = FcDirCacheRotl (h1, 27) + h2;
+	h1 = h1 * 5 + 0x52dce729;
+
+	k2 *= c2;
+	k2 = FcDirCacheRotl (k2, 33);
+	k2 *= c1;
+	h2 ^= k2;
+	h2 = FcDirCacheRotl (h2, 31) + h1;
+	h2 = h2 * 5 + 0x38495ab5;
+    }
+    h1 += h2;
+    h2 += h1;
+    h1 = FcDirCacheMix (h1);
+    h2 = FcDirCacheMix (h2);
+    h1 += h2;
+    h2 += h1;
+    for (j = 0; j < 8; j++)
+    {
+	hash[j] = (unsigned char) (h1 >> (8 * j));
+	hash[j + 8] = (unsigned char) (h2 >> (8 * j));
+    }
+}
+#endif
+
 static FcChar8 *
-FcDirCacheBasename (const FcChar8 * dir, FcChar8 cache_base[CACHEBASE_LEN])
+FcDirCacheHashName (const FcChar8 * dir, size_t len, FcChar8 cache_base[CACHEBASE_LEN])
 {
     unsigned char 	hash[16];
     FcChar8		*hex_hash;
     int			cnt;
+#ifndef FC_CACHE_FAST_NAMES
     struct MD5Context 	ctx;
 
     MD5Init (&ctx);
-    MD5Update (&ctx, (const unsigned char *)dir, strlen ((const char *) dir));
+    MD5Update (&ctx, (const unsigned char *)dir, len);
 
     MD5Final (hash, &ctx);
+#else
+    FcDirCacheHashFast (dir, len, hash);
+#endif
 
     cache_base[0] = '/';
     hex_hash = cache_base + 1;
@@ -110,11 +211,91 @@ FcDirCacheBasename (const FcChar8 * dir, FcChar8 cache_base[CACHEBASE_LEN])
 	hex_hash[2*cnt+1] = bin2hex[hash[cnt] & 0xf];
     }
     hex_hash[2*cnt] = 0;
-    strcat ((char *) cache_base, "-" FC_ARCHITECTURE FC_CACHE_SUFFIX);
+    strcat ((char *) cache_base, FC_CACHE_NAME_TAG);
 
     return cache_base;
 }
 
+/*
+ * Cache names of the directories seen so far, as loading, writing and
+ * unlinking a directory cache all need it.  A slot is filled once and
+ * then left alone until FcCacheFini, so lookups need no lock.
+ */
+#define FC_CACHE_BASENAME_SLOTS	128
+#define FC_CACHE_BASENAME_PROBE	8
+
+typedef struct _FcCacheBasename {
+    FcChar32	hash;
+    FcChar8	base[CACHEBASE_LEN];
+    FcChar8	dir[1];
+} FcCacheBasename;
+
+static FcCacheBasename	*fcCacheBasenames[FC_CACHE_BASENAME_SLOTS];
+
+static FcChar8 *
+FcDirCacheBasename (const FcChar8 * dir, FcChar8 cache_base[CACHEBASE_LEN])
+{
+    FcCacheBasename *b, *new = NULL;
+    FcChar32	    hash = FcDirCacheStrHash (dir);
+    size_t	    len = strlen ((const char *) dir);
+    int		    i, slot;
+
+    for (i = 0; i < FC_CACHE_BASENAME_PROBE; i++)
+    {
+	slot = (hash + i) % FC_CACHE_BASENAME_SLOTS;
+	b = fc_atomic_ptr_get (&fcCacheBasenames[slot]);
+	if (!b)
+	{
+	    if (!new)
+	    {
+		new = malloc (sizeof (FcCacheBasename) + len);
+		if (!new)
+		    break;
+		new->hash = hash;
+		memcpy (new->dir, dir, len + 1);
+		FcDirCacheHashName (dir, len, new->base);
+	    }
+	    if (fc_atomic_ptr_cmpexch (&fcCacheBasenames[slot], NULL, new))
+	    {
+		memcpy (cache_base, new->base, CACHEBASE_LEN);
+		return cache_base;
+	    }
+	    /* Someone else took the slot */
+	    b = fc_atomic_ptr_get (&fcCacheBasenames[slot]);
+	}
+	if (b->hash == hash && !strcmp ((const char *) b->dir, (const char *) dir))
+	{
+	    if (new)
+		free (new);
+	    memcpy (cache_base, b->base, CACHEBASE_LEN);
+	    return cache_base;
+	}
+    }
+
+    /* No room left around the slot; hand out the name without keeping it */
+    if (new)
+    {
+	memcpy (cache_base, new->base, CACHEBASE_LEN);
+	free (new);
+	return cache_base;
+    }
+    return FcDirCacheHashName (dir, len, cache_base);
+}
+
+static void
+FcDirCacheBasenameFini (void)
+{
+    FcCacheBasename *b;
+    int		    i;
+
+    for (i = 0; i < FC_CACHE_BASENAME_SLOTS; i++)
+    {
+	b = fc_atomic_ptr_get (&fcCacheBasenames[i]);
+	if (b && fc_atomic_ptr_cmpexch (&fcCacheBasenames[i], b, NULL))
+	    free (b);
+    }
+}
+
 FcBool
 FcDirCacheUnlink (const FcChar8 *dir, FcConfig *config)
 {
@@ -239,33 +420,51 @@ FcDirCacheProcess (FcConfig *config, const FcChar8 *dir,
 #define FC_CACHE_MIN_MMAP   1024
 
 /*
- * Skip list element, make sure the 'next' pointer is the last thing
- * in the structure, it will be allocated large enough to hold all
- * of the necessary pointers
+ * Loaded caches are kept in an index sorted by address, so that the
+ * cache holding an object can be found by bisection.  The index is
+ * never modified once published; inserting or removing a cache
+ * publishes a new copy under cache_lock, so lookups need no lock.
+ *
+ * Replaced indices are retired rather than freed, as lookups may still
+ * be walking them, and are released once no lookup is in progress.
  */
 
-typedef struct _FcCacheSkip FcCacheSkip;
+typedef struct _FcCacheEntry FcCacheEntry;
 
-struct _FcCacheSkip {
+struct _FcCacheEntry {
     FcCache	    *cache;
     FcRef	    ref;
     intptr_t	    size;
     dev_t	    cache_dev;
     ino_t	    cache_ino;
     time_t	    cache_mtime;
-    FcCacheSkip	    *next[1];
 };
 
+typedef struct _FcCacheIndexElt {
+    char	    *start;
+    char	    *end;
+    FcCacheEntry    *entry;
+} FcCacheIndexElt;
+
 /*
- * The head of the skip list; pointers for every possible level
- * in the skip list, plus the largest level in the list
+ * Make sure the 'elts' array is the last thing in the structure, it
+ * will be allocated large enough to hold all of the caches
  */
+typedef struct _FcCacheIndex FcCacheIndex;
+
+struct _FcCacheIndex {
+    FcCacheIndex    *retired;
+    int		    num;
+    FcCacheIndexElt elts[1];
+};
 
-#define FC_CACHE_MAX_LEVEL  16
+/* Published index, NULL when no cache is loaded */
+static FcCacheIndex	*fcCacheIndex;
+/* Number of lookups walking an index without cache_lock */
+static FcRef		fcCacheReaders;
 
 /* Protected by cache_lock below */
-static FcCacheSkip	*fcCacheChains[FC_CACHE_MAX_LEVEL];
-static int		fcCacheMaxLevel;
+static FcCacheIndex	*fcCacheRetired;
 
 
 static FcMutex *cache_lock;
@@ -283,11 +482,6 @@ retry:
       FcMutexFinish (lock);
       goto retry;
     }
-
-    FcMutexLock (lock);
-    /* Initialize random state */
-    FcRandom ();
-    return;
   }
   FcMutexLock (lock);
 }
@@ -309,174 +503,226 @@ free_lock (void)
   }
 }
 
+static void
+FcCacheIndexFreeRetired (void)
+{
+    FcCacheIndex    *index;
 
+    while ((index = fcCacheRetired))
+    {
+	fcCacheRetired = index->retired;
+	free (index);
+    }
+}
 
 /*
- * Generate a random level number, distributed
- * so that each level is 1/4 as likely as the one before
- *
- * Note that level numbers run 1 <= level <= MAX_LEVEL
+ * Replace the published index, called with cache_lock held
  */
-static int
-random_level (void)
+static void
+FcCacheIndexPublish (FcCacheIndex *index)
 {
-    /* tricky bit -- each bit is '1' 75% of the time */
-    long int	bits = FcRandom () | FcRandom ();
-    int	level = 0;
+    FcCacheIndex    *old = fcCacheIndex;
 
-    while (++level < FC_CACHE_MAX_LEVEL)
+    (void) fc_atomic_ptr_cmpexch (&fcCacheIndex, old, index);
+    if (old)
     {
-	if (bits & 1)
-	    break;
-	bits >>= 1;
+	old->retired = fcCacheRetired;
+	fcCacheRetired = old;
     }
-    return level;
+    /*
+     * Lookups starting from now on see the new index, so with none in
+     * progress no one can be using a retired one
+     */
+    if (fc_atomic_int_add (fcCacheReaders.count, 0) == 0)
+	FcCacheIndexFreeRetired ();
 }
 
 /*
- * Insert cache into the list
+ * Copy the published index with room for 'num' caches,
+ * called with cache_lock held
  */
-static FcBool
-FcCacheInsert (FcCache *cache, struct stat *cache_stat)
+static FcCacheIndex *
+FcCacheIndexCreate (int num)
 {
-    FcCacheSkip    **update[FC_CACHE_MAX_LEVEL];
-    FcCacheSkip    *s, **next;
-    int		    i, level;
+    FcCacheIndex    *index;
 
-    lock_cache ();
+    index = malloc (sizeof (FcCacheIndex) + (num - 1) * sizeof (FcCacheIndexElt));
+    if (!index)
+	return NULL;
+    index->retired = NULL;
+    index->num = num;
+    return index;
+}
 
-    /*
-     * Find links along each chain
-     */
-    next = fcCacheChains;
-    for (i = fcCacheMaxLevel; --i >= 0; )
-    {
-	for (; (s = next[i]); next = s->next)
-	    if (s->cache > cache)
-		break;
-        update[i] = &next[i];
-    }
+/*
+ * Find the position of the first cache starting above 'object'
+ */
+static int
+FcCacheIndexBisect (const FcCacheIndex *index, const void *object)
+{
+    int		    low, high, mid;
 
-    /*
-     * Create new list element
-     */
-    level = random_level ();
-    if (level > fcCacheMaxLevel)
+    low = 0;
+    high = index->num;
+    while (low < high)
     {
-	level = fcCacheMaxLevel + 1;
-	update[fcCacheMaxLevel] = &fcCacheChains[fcCacheMaxLevel];
-	fcCacheMaxLevel = level;
+	mid = (low + high) >> 1;
+	if ((const char *) object < index->elts[mid].start)
+	    high = mid;
+	else
+	    low = mid + 1;
     }
+    return low;
+}
+
+static FcCacheEntry *
+FcCacheIndexFind (const FcCacheIndex *index, const void *object)
+{
+    int		    i;
+
+    if (!index || !object)
+	return NULL;
+    i = FcCacheIndexBisect (index, object);
+    if (i > 0 && (const char *) object < index->elts[i - 1].end)
+	return index->elts[i - 1].entry;
+    return NULL;
+}
 
-    s = malloc (sizeof (FcCacheSkip) + (level - 1) * sizeof (FcCacheSkip *));
-    if (!s)
+/*
+ * Insert cache into the index
+ */
+static FcBool
+FcCacheInsert (FcCache *cache, struct stat *cache_stat)
+{
+    FcCacheIndex    *old, *index;
+    FcCacheEntry    *entry;
+    int		    num, pos;
+
+    entry = malloc (sizeof (FcCacheEntry));
+    if (!entry)
 	return FcFalse;
 
-    s->cache = cache;
-    s->size = cache->size;
-    FcRefInit (&s->ref, 1);
+    entry->cache = cache;
+    entry->size = cache->size;
+    FcRefInit (&entry->ref, 1);
     if (cache_stat)
     {
-	s->cache_dev = cache_stat->st_dev;
-	s->cache_ino = cache_stat->st_ino;
-	s->cache_mtime = cache_stat->st_mtime;
+	entry->cache_dev = cache_stat->st_dev;
+	entry->cache_ino = cache_stat->st_ino;
+	entry->cache_mtime = cache_stat->st_mtime;
     }
     else
     {
-	s->cache_dev = 0;
-	s->cache_ino = 0;
-	s->cache_mtime = 0;
+	entry->cache_dev = 0;
+	entry->cache_ino = 0;
+	entry->cache_mtime = 0;
     }
 
-    /*
-     * Insert into all fcCacheChains
-     */
-    for (i = 0; i < level; i++)
+    lock_cache ();
+
+    old = fcCacheIndex;
+    num = old ? old->num : 0;
+    index = FcCacheIndexCreate (num + 1);
+    if (!index)
     {
-	s->next[i] = *update[i];
-	*update[i] = s;
+	unlock_cache ();
+	free (entry);
+	return FcFalse;
     }
+    pos = old ? FcCacheIndexBisect (old, cache) : 0;
+    if (pos > 0)
+	memcpy (index->elts, old->elts, pos * sizeof (FcCacheIndexElt));
+    index->elts[pos].start = (char *) cache;
+    index->elts[pos].end = (char *) cache + cache->size;
+    index->elts[pos].entry = entry;
+    if (pos < num)
+	memcpy (index->elts + pos + 1, old->elts + pos,
+		(num - pos) * sizeof (FcCacheIndexElt));
+
+    FcCacheIndexPublish (index);
 
     unlock_cache ();
     return FcTrue;
 }
 
-static FcCacheSkip *
+/*
+ * Find the cache holding 'object', called with cache_lock held
+ */
+static FcCacheEntry *
 FcCacheFindByAddrUnlocked (void *object)
 {
-    int	    i;
-    FcCacheSkip    **next = fcCacheChains;
-    FcCacheSkip    *s;
-
-    if (!object)
-	return NULL;
-
-    /*
-     * Walk chain pointers one level at a time
-     */
-    for (i = fcCacheMaxLevel; --i >= 0;)
-	while (next[i] && (char *) object >= ((char *) next[i]->cache + next[i]->size))
-	    next = next[i]->next;
-    /*
-     * Here we are
-     */
-    s = next[0];
-    if (s && (char *) object < ((char *) s->cache + s->size))
-	return s;
-    return NULL;
+    return FcCacheIndexFind (fcCacheIndex, object);
 }
 
-static FcCacheSkip *
+static FcCacheEntry *
 FcCacheFindByAddr (void *object)
 {
-    FcCacheSkip *ret;
-    lock_cache ();
-    ret = FcCacheFindByAddrUnlocked (object);
-    unlock_cache ();
+    FcCacheEntry    *ret;
+
+    if (!object)
+	return NULL;
+    FcRefInc (&fcCacheReaders);
+    ret = FcCacheIndexFind (fc_atomic_ptr_get (&fcCacheIndex), object);
+    FcRefDec (&fcCacheReaders);
     return ret;
 }
 
-static void
+static FcBool
 FcCacheRemoveUnlocked (FcCache *cache)
 {
-    FcCacheSkip	    **update[FC_CACHE_MAX_LEVEL];
-    FcCacheSkip	    *s, **next;
-    int		    i;
+    FcCacheIndex    *old, *index;
+    FcCacheEntry    *entry;
+    int		    pos;
 
-    /*
-     * Find links along each chain
-     */
-    next = fcCacheChains;
-    for (i = fcCacheMaxLevel; --i >= 0; )
+    old = fcCacheIndex;
+    if (!old)
+	return FcFalse;
+    pos = FcCacheIndexBisect (old, cache) - 1;
+    if (pos < 0 || old->elts[pos].start != (char *) cache)
+	return FcFalse;
+    entry = old->elts[pos].entry;
+
+    if (old->num == 1)
+	index = NULL;
+    else
     {
-	for (; (s = next[i]); next = s->next)
-	    if (s->cache >= cache)
-		break;
-        update[i] = &next[i];
+	/*
+	 * Without memory for a new index, keep the cache in the old
+	 * one; it merely stays mapped
+	 */
+	index = FcCacheIndexCreate (old->num - 1);
+	if (!index)
+	    return FcFalse;
+	memcpy (index->elts, old->elts, pos * sizeof (FcCacheIndexElt));
+	memcpy (index->elts + pos, old->elts + pos + 1,
+		(old->num - pos - 1) * sizeof (FcCacheIndexElt));
     }
-    s = next[0];
-    for (i = 0; i < fcCacheMaxLevel && *update[i] == s; i++)
-	*update[i] = s->next[i];
-    while (fcCacheMaxLevel > 0 && fcCacheChains[fcCacheMaxLevel - 1] == NULL)
-	fcCacheMaxLevel--;
-    free (s);
+    FcCacheIndexPublish (index);
+    free (entry);
+    return FcTrue;
 }
 
 static FcCache *
 FcCacheFindByStat (struct stat *cache_stat)
 {
-    FcCacheSkip	    *s;
+    FcCacheIndex    *index;
+    FcCacheEntry    *entry;
+    int		    i;
 
     lock_cache ();
-    for (s = fcCacheChains[0]; s; s = s->next[0])
-	if (s->cache_dev == cache_stat->st_dev &&
-	    s->cache_ino == cache_stat->st_ino &&
-	    s->cache_mtime == cache_stat->st_mtime)
+    index = fcCacheIndex;
+    for (i = 0; index && i < index->num; i++)
+    {
+	entry = index->elts[i].entry;
+	if (entry->cache_dev == cache_stat->st_dev &&
+	    entry->cache_ino == cache_stat->st_ino &&
+	    entry->cache_mtime == cache_stat->st_mtime)
 	{
-	    FcRefInc (&s->ref);
+	    FcRefInc (&entry->ref);
 	    unlock_cache ();
-	    return s->cache;
+	    return entry->cache;
 	}
+    }
     unlock_cache ();
     return NULL;
 }
@@ -484,7 +730,8 @@ FcCacheFindByStat (struct stat *cache_stat)
 static void
 FcDirCacheDisposeUnlocked (FcCache *cache)
 {
-    FcCacheRemoveUnlocked (cache);
+    if (!FcCacheRemoveUnlocked (cache))
+	return;
 
     switch (cache->magic) {
     case FC_CACHE_MAGIC_ALLOC:
@@ -503,36 +750,960 @@ FcDirCacheDisposeUnlocked (FcCache *cache)
 void
 FcCacheObjectReference (void *object)
 {
-    FcCacheSkip *skip = FcCacheFindByAddr (object);
+    FcCacheEntry *entry = FcCacheFindByAddr (object);
 
-    if (skip)
-	FcRefInc (&skip->ref);
+    if (entry)
+	FcRefInc (&entry->ref);
 }
 
 void
 FcCacheObjectDereference (void *object)
 {
-    FcCacheSkip	*skip;
+    FcCacheEntry    *entry = FcCacheFindByAddr (object);
+
+    if (!entry || FcRefDec (&entry->ref) != 1)
+	return;
+
+    /*
+     * That was the last reference.  FcCacheFindByStat may have revived
+     * the cache before we got the lock, so only dispose of it if the
+     * count is still zero.
+     */
+    lock_cache ();
+    entry = FcCacheFindByAddrUnlocked (object);
+    if (entry && fc_atomic_int_add (entry->ref.count, 0) == 0)
+	FcDirCacheDisposeUnlocked (entry->cache);
+    unlock_cache ();
+}
+
+/*
+ * Each cache directory may hold a validation manifest.  For every font
+ * directory it records the device, inode and checksum of the directory
+ * when it was scanned, and what the scan found that could change without
+ * touching the directory itself: the device and inode of each
+ * subdirectory, and the symbolic links that did not lead to one.
+ * Entries can only be added or removed by changing the directory, so
+ * FcCacheDirsValid can check the recorded names again instead of reading
+ * the whole directory.
+ *
+ * The manifest is mapped once per process and looked up by bisection;
+ * entries are sorted by the hash of the directory name.
+ */
+
+#define FC_MANIFEST_NAME	"manifest-" FC_ARCHITECTURE FC_CACHE_SUFFIX
+#define FC_MANIFEST_MAGIC	0xFC02FC10
+#define FC_MANIFEST_VERSION	2
+
+typedef struct _FcManifestHeader {
+    unsigned int    magic;
+    int		    version;
+    FcChar32	    globs;	/* hash of the file name rules used to scan */
+    int		    count;
+    intptr_t	    size;
+} FcManifestHeader;
+
+typedef struct _FcManifestEntry {
+    FcChar32	    hash;
+    int		    checksum;
+    int		    dirs_count;
+    int		    dir;	/* offset of the directory name */
+    int		    paths;	/* offset of the FcManifestPath records */
+    int		    num_paths;
+    dev_t	    dev;
+    ino_t	    ino;
+} FcManifestEntry;
+
+/* A subdirectory, or a symbolic link that is not one if ino is 0 */
+typedef struct _FcManifestPath {
+    int		    name;	/* offset of the path name */
+    dev_t	    dev;
+    ino_t	    ino;
+} FcManifestPath;
+
+#define FcManifestEntries(h)	((FcManifestEntry *) ((h) + 1))
+#define FcManifestDir(h,e)	((const FcChar8 *) (h) + (e)->dir)
+#define FcManifestPaths(b,o)	((const FcManifestPath *) ((const char *) (b) + (o)))
+#define FcManifestName(b,p)	((const FcChar8 *) (b) + (p)->name)
+
+typedef struct _FcManifest FcManifest;
+
+struct _FcManifest {
+    FcManifest	    *next;
+    FcChar8	    *file;
+    FcManifestHeader *header;	/* NULL if missing or invalid */
+    size_t	    size;
+    FcBool	    mapped;
+};
+
+/* Protected by cache_lock */
+static FcManifest	*fcManifests;
+
+static FcChar32
+FcManifestGlobsHash (FcConfig *config)
+{
+    FcStrSet	*sets[2];
+    FcStrList	*list;
+    FcChar8	*s;
+    FcChar32	h = 0;
+    int		i;
+
+    sets[0] = config->acceptGlobs;
+    sets[1] = config->rejectGlobs;
+    for (i = 0; i < 2; i++)
+    {
+	list = FcStrListCreate (sets[i]);
+	if (!list)
+	    continue;
+	while ((s = FcStrListNext (list)))
+	    h = h * 31 + FcDirCacheStrHash (s);
+	FcStrListDone (list);
+	h = h * 31 + i + 1;
+    }
+    return h;
+}
+
+static FcBool
+FcManifestValid (const FcManifestHeader *header, size_t size)
+{
+    const FcManifestEntry   *entries = FcManifestEntries (header);
+    const FcManifestPath    *paths;
+    size_t		    start;
+    int			    i, j;
+
+    if (header->magic != FC_MANIFEST_MAGIC ||
+	header->version != FC_MANIFEST_VERSION ||
+	header->size != (intptr_t) size ||
+	header->count < 0 ||
+	(size - sizeof (FcManifestHeader)) / sizeof (FcManifestEntry) < (size_t) header->count ||
+	((const char *) header)[size - 1] != '\0')
+	return FcFalse;
+    start = sizeof (FcManifestHeader) + header->count * sizeof (FcManifestEntry);
+    for (i = 0; i < header->count; i++)
+    {
+	if (entries[i].dir < 0 || (size_t) entries[i].dir < start ||
+	    (size_t) entries[i].dir >= size)
+	    return FcFalse;
+	if (entries[i].num_paths == 0)
+	    continue;
+	if (entries[i].paths < 0 || (size_t) entries[i].paths < start ||
+	    (entries[i].paths - start) % sizeof (FcManifestPath) ||
+	    entries[i].num_paths < 0 ||
+	    (size - entries[i].paths) / sizeof (FcManifestPath) < (size_t) entries[i].num_paths)
+	    return FcFalse;
+	paths = FcManifestPaths (header, entries[i].paths);
+	for (j = 0; j < entries[i].num_paths; j++)
+	    if (paths[j].name < 0 || (size_t) paths[j].name < start ||
+		(size_t) paths[j].name >= size)
+		return FcFalse;
+    }
+    return FcTrue;
+}
+
+static void
+FcManifestRelease (FcManifestHeader *header, size_t size, FcBool mapped)
+{
+    if (!header)
+	return;
+#if defined(HAVE_MMAP) || defined(__CYGWIN__)
+    if (mapped)
+    {
+	munmap (header, size);
+	return;
+    }
+#endif
+    free (header);
+}
+
+/*
+ * Map and check a manifest file
+ */
+static FcManifestHeader *
+FcManifestMap (const FcChar8 *file, size_t *size, FcBool *mapped)
+{
+    FcManifestHeader	*header = NULL;
+    struct stat		file_stat;
+    int			fd;
+
+    *mapped = FcFalse;
+    fd = FcDirCacheOpenFile (file, &file_stat);
+    if (fd < 0)
+	return NULL;
+    if (file_stat.st_size < (off_t) sizeof (FcManifestHeader))
+    {
+	close (fd);
+	return NULL;
+    }
+    *size = file_stat.st_size;
+#if defined(HAVE_MMAP) || defined(__CYGWIN__)
+    header = mmap (0, *size, PROT_READ, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED)
+	header = NULL;
+    else
+	*mapped = FcTrue;
+#endif
+    if (!header)
+    {
+	header = malloc (*size);
+	if (header && read (fd, header, *size) != (ssize_t) *size)
+	{
+	    free (header);
+	    header = NULL;
+	}
+    }
+    close (fd);
+    if (header && !FcManifestValid (header, *size))
+    {
+	FcManifestRelease (header, *size, *mapped);
+	header = NULL;
+    }
+    return header;
+}
+
+static const FcManifestEntry *
+FcManifestLookup (const FcManifestHeader *header, const FcChar8 *dir)
+{
+    const FcManifestEntry   *entries = FcManifestEntries (header);
+    FcChar32		    hash = FcDirCacheStrHash (dir);
+    int			    low, high, mid;
+
+    low = 0;
+    high = header->count;
+    while (low < high)
+    {
+	mid = (low + high) >> 1;
+	if (entries[mid].hash < hash)
+	    low = mid + 1;
+	else
+	    high = mid;
+    }
+    for (; low < header->count && entries[low].hash == hash; low++)
+	if (!strcmp ((const char *) FcManifestDir (header, &entries[low]),
+		     (const char *) dir))
+	    return &entries[low];
+    return NULL;
+}
+
+static FcManifest *
+FcManifestFind (const FcChar8 *file)
+{
+    FcManifest	*m;
+
+    for (m = fcManifests; m; m = m->next)
+	if (!strcmp ((const char *) m->file, (const char *) file))
+	    return m;
+    return NULL;
+}
+
+static void
+FcManifestDestroy (FcManifest *m)
+{
+    FcManifestRelease (m->header, m->size, m->mapped);
+    FcStrFree (m->file);
+    free (m);
+}
+
+/*
+ * Find the manifest loaded from 'file', loading it on first use,
+ * called with cache_lock held.  The lock is dropped while the file
+ * is read.
+ */
+static FcManifest *
+FcManifestGet (const FcChar8 *file)
+{
+    FcManifest	*m, *new;
+
+    m = FcManifestFind (file);
+    if (m)
+	return m;
+
+    unlock_cache ();
+    new = malloc (sizeof (FcManifest));
+    if (new)
+    {
+	new->file = FcStrdup (file);
+	if (new->file)
+	    new->header = FcManifestMap (file, &new->size, &new->mapped);
+	else
+	{
+	    free (new);
+	    new = NULL;
+	}
+    }
+    lock_cache ();
+
+    /* Some other thread may have loaded it meanwhile */
+    m = FcManifestFind (file);
+    if (m || !new)
+    {
+	if (new)
+	    FcManifestDestroy (new);
+	return m;
+    }
+    new->next = fcManifests;
+    fcManifests = new;
+    return new;
+}
+
+/*
+ * Forget the manifest loaded from 'file', or all of them if NULL,
+ * called with cache_lock held
+ */
+static void
+FcManifestForget (const FcChar8 *file)
+{
+    FcManifest	**prev, *m;
+
+    for (prev = &fcManifests; (m = *prev);)
+    {
+	if (file && strcmp ((const char *) m->file, (const char *) file))
+	{
+	    prev = &m->next;
+	    continue;
+	}
+	*prev = m->next;
+	FcManifestDestroy (m);
+    }
+}
+
+/*
+ * Recorded path names are those of the cache, without the sysroot
+ */
+static int
+FcManifestStat (const FcChar8 *sysroot, const FcChar8 *name, struct stat *statb)
+{
+    FcChar8	*file;
+    int		ret;
+
+    if (!sysroot)
+	return FcStat (name, statb);
+    file = FcStrBuildFilename (sysroot, name, NULL);
+    if (!file)
+	return -1;
+    ret = FcStat (file, statb);
+    FcStrFree (file);
+    return ret;
+}
+
+/*
+ * Check that the recorded paths are still what the scan found
+ */
+static FcBool
+FcManifestPathsValid (const FcChar8 *sysroot, const void *base,
+		      const FcManifestPath *paths, int num_paths)
+{
+    struct stat	statb;
+    int		i;
+
+    for (i = 0; i < num_paths; i++)
+    {
+	if (FcManifestStat (sysroot, FcManifestName (base, &paths[i]), &statb) < 0)
+	{
+	    if (paths[i].ino)
+		return FcFalse;
+	    continue;
+	}
+	if (!paths[i].ino)
+	{
+	    if (S_ISDIR (statb.st_mode))
+		return FcFalse;
+	    continue;
+	}
+	if (!S_ISDIR (statb.st_mode) ||
+	    statb.st_dev != paths[i].dev ||
+	    statb.st_ino != paths[i].ino)
+	    return FcFalse;
+    }
+    return FcTrue;
+}
+
+/*
+ * Copy the path records of a manifest entry, followed by their names
+ * as FcManifestPathsCreate lays them out, so they can be checked after
+ * cache_lock is released
+ */
+static FcManifestPath *
+FcManifestPathsCopy (const FcManifestHeader *header, const FcManifestEntry *e)
+{
+    const FcManifestPath    *src = NULL;
+    FcManifestPath	    *paths;
+    const FcChar8	    *name;
+    size_t		    size;
+    int			    i, offset;
+
+    if (e->num_paths)
+	src = FcManifestPaths (header, e->paths);
+    size = e->num_paths * sizeof (FcManifestPath) + 1;
+    for (i = 0; i < e->num_paths; i++)
+	size += strlen ((const char *) FcManifestName (header, &src[i])) + 1;
+    paths = malloc (size);
+    if (!paths)
+	return NULL;
+
+    offset = e->num_paths * sizeof (FcManifestPath);
+    for (i = 0; i < e->num_paths; i++)
+    {
+	name = FcManifestName (header, &src[i]);
+	paths[i] = src[i];
+	paths[i].name = offset;
+	strcpy ((char *) paths + offset, (const char *) name);
+	offset += strlen ((const char *) name) + 1;
+    }
+    return paths;
+}
+
+/*
+ * Check whether a manifest vouches for the subdirectories of the cache
+ */
+static FcBool
+FcManifestCheck (FcConfig *config, FcCache *cache, struct stat *dir_stat)
+{
+    FcStrList		    *list;
+    FcChar8		    *cache_dir, *file;
+    FcManifest		    *m;
+    const FcManifestEntry   *e;
+    FcManifestPath	    *paths;
+    FcChar32		    globs;
+    int			    num_paths = 0;
+    FcBool		    ret = FcFalse;
+    const FcChar8	    *sysroot = FcConfigGetSysRoot (config);
+
+    if (cache->checksum != (int) dir_stat->st_mtime)
+	return FcFalse;
+    list = FcStrListCreate (config->cacheDirs);
+    if (!list)
+	return FcFalse;
+    globs = FcManifestGlobsHash (config);
+
+    while (!ret && (cache_dir = FcStrListNext (list)))
+    {
+	if (sysroot)
+	    file = FcStrBuildFilename (sysroot, cache_dir, (FcChar8 *) FC_MANIFEST_NAME, NULL);
+	else
+	    file = FcStrBuildFilename (cache_dir, (FcChar8 *) FC_MANIFEST_NAME, NULL);
+	if (!file)
+	    break;
+
+	/* Only take a copy of the entry under the lock */
+	paths = NULL;
+	lock_cache ();
+	m = FcManifestGet (file);
+	if (m && m->header && m->header->globs == globs)
+	{
+	    e = FcManifestLookup (m->header, FcCacheDir (cache));
+	    if (e &&
+		e->dev == dir_stat->st_dev &&
+		e->ino == dir_stat->st_ino &&
+		e->checksum == cache->checksum &&
+		e->dirs_count == cache->dirs_count)
+	    {
+		paths = FcManifestPathsCopy (m->header, e);
+		num_paths = e->num_paths;
+	    }
+	}
+	unlock_cache ();
+	FcStrFree (file);
+
+	if (paths)
+	{
+	    ret = FcManifestPathsValid (sysroot, paths, paths, num_paths);
+	    free (paths);
+	}
+    }
+    FcStrListDone (list);
+
+    return ret;
+}
+
+/*
+ * Record the subdirectories of the cache, as found in the scanned
+ * directory 'dir', and the symbolic links there that are not ones.
+ * 'd' is 'dir' with the sysroot prepended.  The records are followed
+ * by the path names in a single allocation.
+ */
+static FcManifestPath *
+FcManifestPathsCreate (FcConfig *config, FcCache *cache, const FcChar8 *dir,
+		       const FcChar8 *d, int *num_paths)
+{
+    FcStrSet		*links;
+    FcManifestPath	*paths = NULL;
+    struct stat		statb;
+    const FcChar8	*name;
+    const FcChar8	*sysroot = FcConfigGetSysRoot (config);
+    FcChar8		*file;
+    DIR			*dp;
+    struct dirent	*e;
+    size_t		size;
+    int			i, num, offset;
+
+    links = FcStrSetCreate ();
+    if (!links)
+	return NULL;
+    dp = opendir ((char *) d);
+    if (!dp)
+	goto bail;
+    while ((e = readdir (dp)))
+    {
+	if (e->d_name[0] == '.' || strlen (e->d_name) >= FC_MAX_FILE_LEN)
+	    continue;
+	file = FcStrBuildFilename (d, (FcChar8 *) e->d_name, NULL);
+	if (!file)
+	    break;
+#ifdef S_ISLNK
+	if (FcConfigAcceptFilename (config, file) &&
+	    lstat ((char *) file, &statb) == 0 && S_ISLNK (statb.st_mode) &&
+	    (FcStat (file, &statb) < 0 || !S_ISDIR (statb.st_mode)))
+	{
+	    FcStrFree (file);
+	    file = FcStrBuildFilename (dir, (FcChar8 *) e->d_name, NULL);
+	    if (!file || !FcStrSetAdd (links, file))
+	    {
+		if (file)
+		    FcStrFree (file);
+		break;
+	    }
+	}
+#endif
+	FcStrFree (file);
+    }
+    if (e)
+    {
+	closedir (dp);
+	goto bail;
+    }
+    closedir (dp);
+
+    num = cache->dirs_count + links->num;
+    size = num * sizeof (FcManifestPath);
+    for (i = 0; i < cache->dirs_count; i++)
+	size += strlen ((const char *) FcCacheSubdir (cache, i)) + 1;
+    for (i = 0; i < links->num; i++)
+	size += strlen ((const char *) links->strs[i]) + 1;
+    paths = malloc (size);
+    if (!paths)
+	goto bail;
+
+    offset = num * sizeof (FcManifestPath);
+    for (i = 0; i < num; i++)
+    {
+	if (i < cache->dirs_count)
+	{
+	    name = FcCacheSubdir (cache, i);
+	    /* Changed since the scan, the entry could not be trusted */
+	    if (FcManifestStat (sysroot, name, &statb) < 0 || !S_ISDIR (statb.st_mode))
+	    {
+		free (paths);
+		paths = NULL;
+		goto bail;
+	    }
+	    paths[i].dev = statb.st_dev;
+	    paths[i].ino = statb.st_ino;
+	}
+	else
+	{
+	    name = links->strs[i - cache->dirs_count];
+	    paths[i].dev = 0;
+	    paths[i].ino = 0;
+	}
+	paths[i].name = offset;
+	strcpy ((char *) paths + offset, (const char *) name);
+	offset += strlen ((const char *) name) + 1;
+    }
+    *num_paths = num;
+
+bail:
+    FcStrSetDestroy (links);
+    return paths;
+}
+
+/*
+ * Rewriting a manifest for every cache written would take quadratic
+ * time in a full scan, so new entries are collected per manifest and
+ * written together.  A batch is written once it holds as many entries
+ * as the manifest did last time, which keeps the total work linear, and
+ * whatever is left by FcCacheFini.  Until then the old entries simply
+ * fail to match the new caches, and the directories are read instead.
+ */
+#define FC_MANIFEST_BATCH	64
+
+typedef struct _FcManifestPending {
+    FcManifestEntry	    entry;
+    FcChar8		    *dir;
+    FcManifestPath	    *paths;	/* followed by the path names */
+} FcManifestPending;
+
+typedef struct _FcManifestBatch FcManifestBatch;
+
+struct _FcManifestBatch {
+    FcManifestBatch	    *next;
+    FcChar8		    *file;
+    FcChar32		    globs;
+    int			    flush_at;
+    int			    num;
+    int			    size;
+    FcManifestPending	    *pending;
+};
+
+/* Protected by cache_lock */
+static FcManifestBatch	*fcManifestBatches;
+
+static void
+FcManifestPendingFree (FcManifestPending *pending, int num)
+{
+    int	    i;
+
+    for (i = 0; i < num; i++)
+    {
+	FcStrFree (pending[i].dir);
+	free (pending[i].paths);
+    }
+    free (pending);
+}
+
+typedef struct _FcManifestElt {
+    FcManifestEntry	    entry;
+    const FcChar8	    *dir;
+    const void		    *base;	/* where the path names are */
+    const FcManifestPath    *paths;
+    int			    order;	/* later ones replace earlier ones */
+} FcManifestElt;
+
+static int
+FcManifestEltCmp (const void *a, const void *b)
+{
+    const FcManifestElt	*ea = a, *eb = b;
+    int			r;
+
+    if (ea->entry.hash != eb->entry.hash)
+	return ea->entry.hash < eb->entry.hash ? -1 : 1;
+    r = strcmp ((const char *) ea->dir, (const char *) eb->dir);
+    if (r)
+	return r;
+    return eb->order - ea->order;
+}
+
+/*
+ * Merge the pending entries into the manifest 'file'.  Returns the
+ * number of entries written, or -1.
+ */
+static int
+FcManifestWrite (const FcChar8 *file, FcChar32 globs,
+		 const FcManifestPending *pending, int num)
+{
+    FcAtomic		*atomic;
+    FcManifestHeader	*old, *header;
+    FcManifestEntry	*entries;
+    FcManifestPath	*paths;
+    const FcChar8	*name;
+    FcManifestElt	*elts;
+    size_t		old_size, size;
+    FcBool		mapped;
+    int			i, j, count, kept, fd, offset, paths_offset;
+    int			total_paths;
+    int			ret = -1;
+
+    atomic = FcAtomicCreate (file);
+    if (!atomic)
+	return -1;
+    if (!FcAtomicLock (atomic))
+	goto bail;
+
+    old = FcManifestMap (file, &old_size, &mapped);
+    if (old && old->globs != globs)
+    {
+	/* Scanned with other rules, the old entries no longer apply */
+	FcManifestRelease (old, old_size, mapped);
+	old = NULL;
+    }
+
+    count = old ? old->count : 0;
+    elts = malloc ((count + num) * sizeof (FcManifestElt));
+    if (!elts)
+	goto bail1;
+    count = 0;
+    for (i = 0; old && i < old->count; i++, count++)
+    {
+	elts[count].entry = FcManifestEntries (old)[i];
+	elts[count].dir = FcManifestDir (old, &FcManifestEntries (old)[i]);
+	elts[count].base = old;
+	elts[count].paths = FcManifestPaths (old, elts[count].entry.paths);
+	elts[count].order = -1;
+    }
+    for (i = 0; i < num; i++, count++)
+    {
+	elts[count].entry = pending[i].entry;
+	elts[count].dir = pending[i].dir;
+	elts[count].base = pending[i].paths;
+	elts[count].paths = pending[i].paths;
+	elts[count].order = i;
+    }
+    qsort (elts, count, sizeof (FcManifestElt), FcManifestEltCmp);
+
+    /* Keep the latest entry of each directory */
+    size = 0;
+    total_paths = 0;
+    for (i = 0, kept = 0; i < count; i++)
+    {
+	if (kept && elts[kept - 1].entry.hash == elts[i].entry.hash &&
+	    !strcmp ((const char *) elts[kept - 1].dir, (const char *) elts[i].dir))
+	    continue;
+	elts[kept] = elts[i];
+	size += strlen ((const char *) elts[kept].dir) + 1;
+	for (j = 0; j < elts[kept].entry.num_paths; j++)
+	    size += strlen ((const char *) FcManifestName (elts[kept].base, &elts[kept].paths[j])) + 1;
+	total_paths += elts[kept].entry.num_paths;
+	kept++;
+    }
+    count = kept;
+
+    /* Entries, then the path records of all entries, then the names */
+    paths_offset = sizeof (FcManifestHeader) + count * sizeof (FcManifestEntry);
+    offset = paths_offset + total_paths * sizeof (FcManifestPath);
+    size += offset;
+    header = calloc (1, size);
+    if (!header)
+	goto bail2;
+    header->magic = FC_MANIFEST_MAGIC;
+    header->version = FC_MANIFEST_VERSION;
+    header->globs = globs;
+    header->count = count;
+    header->size = size;
+    entries = FcManifestEntries (header);
+    for (i = 0; i < count; i++)
+    {
+	entries[i] = elts[i].entry;
+	entries[i].dir = offset;
+	strcpy ((char *) header + offset, (const char *) elts[i].dir);
+	offset += strlen ((const char *) elts[i].dir) + 1;
+	entries[i].paths = paths_offset;
+	paths = (FcManifestPath *) ((char *) header + paths_offset);
+	for (j = 0; j < entries[i].num_paths; j++)
+	{
+	    name = FcManifestName (elts[i].base, &elts[i].paths[j]);
+	    paths[j] = elts[i].paths[j];
+	    paths[j].name = offset;
+	    strcpy ((char *) header + offset, (const char *) name);
+	    offset += strlen ((const char *) name) + 1;
+	}
+	paths_offset += entries[i].num_paths * sizeof (FcManifestPath);
+    }
+
+    fd = FcOpen ((char *) FcAtomicNewFile (atomic), O_RDWR | O_CREAT | O_BINARY, 0666);
+    if (fd == -1)
+	goto bail3;
+    if (write (fd, header, size) != (ssize_t) size)
+    {
+	close (fd);
+	FcAtomicDeleteNew (atomic);
+	goto bail3;
+    }
+    close (fd);
+    if (FcAtomicReplaceOrig (atomic))
+    {
+	/* Have the new manifest mapped on next use */
+	lock_cache ();
+	FcManifestForget (file);
+	unlock_cache ();
+	ret = count;
+    }
+
+bail3:
+    free (header);
+bail2:
+    free (elts);
+bail1:
+    FcManifestRelease (old, old_size, mapped);
+    FcAtomicUnlock (atomic);
+bail:
+    FcAtomicDestroy (atomic);
+    return ret;
+}
+
+/*
+ * Take the pending entries out of a batch to write them, called with
+ * cache_lock held
+ */
+static FcManifestPending *
+FcManifestBatchTake (FcManifestBatch *batch, int *num)
+{
+    FcManifestPending	*pending = batch->pending;
+
+    *num = batch->num;
+    batch->pending = NULL;
+    batch->num = 0;
+    batch->size = 0;
+    return pending;
+}
+
+/*
+ * Record the cache just written to 'cache_hashed' in the manifest of
+ * its cache directory
+ */
+static void
+FcManifestUpdate (FcConfig *config, FcCache *cache, const FcChar8 *cache_hashed)
+{
+    const FcChar8	*dir = FcCacheDir (cache);
+    const FcChar8	*sysroot = FcConfigGetSysRoot (config);
+    FcChar8		*d, *cache_dir, *file;
+    FcManifestBatch	*batch;
+    FcManifestPending	*pending, *flush = NULL, *stale = NULL;
+    FcManifestPath	*new_paths;
+    FcChar8		*new_dir = NULL;
+    struct stat		dir_stat;
+    FcChar32		globs, stale_globs = 0;
+    int			num_paths, size, num_flush = 0, num_stale = 0, written;
+
+    /*
+     * The entry must describe the directory as it was scanned.  A
+     * directory changed within the current second may change again
+     * without its checksum changing, so it is not recorded.
+     */
+    if (sysroot)
+	d = FcStrBuildFilename (sysroot, dir, NULL);
+    else
+	d = FcStrdup (dir);
+    if (!d)
+	return;
+    if (FcStatChecksum (d, &dir_stat) < 0 ||
+	(int) dir_stat.st_mtime != cache->checksum ||
+	dir_stat.st_mtime >= time (NULL))
+    {
+	FcStrFree (d);
+	return;
+    }
+    new_paths = FcManifestPathsCreate (config, cache, dir, d, &num_paths);
+    FcStrFree (d);
+    if (!new_paths)
+	return;
+
+    cache_dir = FcStrDirname (cache_hashed);
+    if (!cache_dir)
+	goto bail;
+    file = FcStrBuildFilename (cache_dir, (FcChar8 *) FC_MANIFEST_NAME, NULL);
+    FcStrFree (cache_dir);
+    if (!file)
+	goto bail;
+    new_dir = FcStrdup (dir);
+    if (!new_dir)
+	goto bail0;
+    globs = FcManifestGlobsHash (config);
 
     lock_cache ();
-    skip = FcCacheFindByAddrUnlocked (object);
-    if (skip)
+    for (batch = fcManifestBatches; batch; batch = batch->next)
+	if (!strcmp ((const char *) batch->file, (const char *) file))
+	    break;
+    if (!batch)
+    {
+	batch = calloc (1, sizeof (FcManifestBatch));
+	if (batch)
+	    batch->file = FcStrdup (file);
+	if (!batch || !batch->file)
+	{
+	    unlock_cache ();
+	    free (batch);
+	    goto bail0;
+	}
+	batch->globs = globs;
+	batch->flush_at = FC_MANIFEST_BATCH;
+	batch->next = fcManifestBatches;
+	fcManifestBatches = batch;
+    }
+    if (batch->globs != globs)
     {
-	if (FcRefDec (&skip->ref) == 1)
-	    FcDirCacheDisposeUnlocked (skip->cache);
+	/* Entries scanned with other rules go out on their own */
+	stale = FcManifestBatchTake (batch, &num_stale);
+	stale_globs = batch->globs;
+	batch->globs = globs;
     }
+    if (batch->num == batch->size)
+    {
+	size = batch->size ? batch->size * 2 : 16;
+	pending = realloc (batch->pending, size * sizeof (FcManifestPending));
+	if (!pending)
+	{
+	    unlock_cache ();
+	    goto bail1;
+	}
+	batch->pending = pending;
+	batch->size = size;
+    }
+    pending = &batch->pending[batch->num++];
+    pending->entry.hash = FcDirCacheStrHash (dir);
+    pending->entry.checksum = cache->checksum;
+    pending->entry.dirs_count = cache->dirs_count;
+    pending->entry.num_paths = num_paths;
+    pending->entry.dev = dir_stat.st_dev;
+    pending->entry.ino = dir_stat.st_ino;
+    pending->dir = new_dir;
+    pending->paths = new_paths;
+    new_dir = NULL;
+    new_paths = NULL;
+    if (batch->num >= batch->flush_at)
+	flush = FcManifestBatchTake (batch, &num_flush);
     unlock_cache ();
+
+    if (flush)
+    {
+	written = FcManifestWrite (file, globs, flush, num_flush);
+	if (written > FC_MANIFEST_BATCH)
+	{
+	    lock_cache ();
+	    for (batch = fcManifestBatches; batch; batch = batch->next)
+		if (!strcmp ((const char *) batch->file, (const char *) file))
+		    batch->flush_at = written;
+	    unlock_cache ();
+	}
+	FcManifestPendingFree (flush, num_flush);
+    }
+
+bail1:
+    if (stale)
+    {
+	(void) FcManifestWrite (file, stale_globs, stale, num_stale);
+	FcManifestPendingFree (stale, num_stale);
+    }
+bail0:
+    if (new_dir)
+	FcStrFree (new_dir);
+    FcStrFree (file);
+bail:
+    free (new_paths);
+}
+
+/*
+ * Write the pending manifest entries, from FcCacheFini
+ */
+static void
+FcManifestFlush (void)
+{
+    FcManifestBatch	*batch, *next;
+
+    lock_cache ();
+    batch = fcManifestBatches;
+    fcManifestBatches = NULL;
+    unlock_cache ();
+
+    for (; batch; batch = next)
+    {
+	next = batch->next;
+	if (batch->num)
+	    (void) FcManifestWrite (batch->file, batch->globs,
+				    batch->pending, batch->num);
+	FcManifestPendingFree (batch->pending, batch->num);
+	FcStrFree (batch->file);
+	free (batch);
+    }
 }
 
 void
 FcCacheFini (void)
 {
-    int		    i;
-
-    for (i = 0; i < FC_CACHE_MAX_LEVEL; i++)
-	assert (fcCacheChains[i] == NULL);
-    assert (fcCacheMaxLevel == 0);
+    assert (fcCacheIndex == NULL);
 
+    FcCacheIndexFreeRetired ();
+    FcManifestFlush ();
+    FcManifestForget (NULL);
+    FcDirCacheBasenameFini ();
+    FcFreeTypeFini ();
     free_lock ();
 }
 
@@ -565,13 +1736,18 @@ FcCacheTimeValid (FcConfig *config, FcCache *cache, struct stat *dir_stat)
 }
 
 static FcBool
-FcCacheDirsValid (FcConfig *config, FcCache *cache)
+FcCacheDirsValid (FcConfig *config, FcCache *cache, struct stat *dir_stat)
 {
-    FcStrSet *dirs = FcStrSetCreate ();
+    FcStrSet *dirs;
     FcBool ret = FcFalse;
     const FcChar8 *sysroot = FcConfigGetSysRoot (config);
     FcChar8 *d;
 
+    /* Skip reading the directory when the manifest vouches for it */
+    if (dir_stat && FcManifestCheck (config, cache, dir_stat))
+	return FcTrue;
+
+    dirs = FcStrSetCreate ();
     if (!dirs)
 	goto bail;
     if (sysroot)
@@ -606,7 +1782,7 @@ FcDirCacheMapFd (FcConfig *config, int fd, struct stat *fd_stat, struct stat *di
     if (cache)
     {
 	if (FcCacheTimeValid (config, cache, dir_stat) &&
-	    FcCacheDirsValid (config, cache))
+	    FcCacheDirsValid (config, cache, dir_stat))
 	    return cache;
 	FcDirCacheUnload (cache);
 	cache = NULL;
@@ -658,7 +1834,7 @@ FcDirCacheMapFd (FcConfig *config, int fd, struct stat *fd_stat, struct stat *di
 	cache->version < FC_CACHE_VERSION_NUMBER ||
 	cache->size != (intptr_t) fd_stat->st_size ||
 	!FcCacheTimeValid (config, cache, dir_stat) ||
-	!FcCacheDirsValid (config, cache) ||
+	!FcCacheDirsValid (config, cache, dir_stat) ||
 	!FcCacheInsert (cache, fd_stat))
     {
 	if (allocated)
@@ -684,10 +1860,10 @@ FcDirCacheMapFd (FcConfig *config, int fd, struct stat *fd_stat, struct stat *di
 void
 FcDirCacheReference (FcCache *cache, int nref)
 {
-    FcCacheSkip *skip = FcCacheFindByAddr (cache);
+    FcCacheEntry *entry = FcCacheFindByAddr (cache);
 
-    if (skip)
-	FcRefAdd (&skip->ref, nref);
+    if (entry)
+	FcRefAdd (&entry->ref, nref);
 }
 
 void
@@ -902,7 +2078,7 @@ FcDirCacheWrite (FcCache *cache, FcConfig *config)
     FcStrList	    *list;
     FcChar8	    *cache_dir = NULL;
     FcChar8	    *test_dir, *d = NULL;
-    FcCacheSkip     *skip;
+    FcCacheEntry    *entry;
     struct stat     cache_stat;
     unsigned int    magic;
     int		    written;
@@ -1006,22 +2182,24 @@ FcDirCacheWrite (FcCache *cache, FcConfig *config)
     if (!FcAtomicReplaceOrig(atomic))
         goto bail4;
 
-    /* If the file is small, update the cache chain entry such that the
+    /* If the file is small, update the cache index entry such that the
      * new cache file is not read again.  If it's large, we don't do that
      * such that we reload it, using mmap, which is shared across processes.
      */
     if (cache->size < FC_CACHE_MIN_MMAP && FcStat (cache_hashed, &cache_stat))
     {
 	lock_cache ();
-	if ((skip = FcCacheFindByAddrUnlocked (cache)))
+	if ((entry = FcCacheFindByAddrUnlocked (cache)))
 	{
-	    skip->cache_dev = cache_stat.st_dev;
-	    skip->cache_ino = cache_stat.st_ino;
-	    skip->cache_mtime = cache_stat.st_mtime;
+	    entry->cache_dev = cache_stat.st_dev;
+	    entry->cache_ino = cache_stat.st_ino;
+	    entry->cache_mtime = cache_stat.st_mtime;
 	}
 	unlock_cache ();
     }
 
+    FcManifestUpdate (config, cache, cache_hashed);
+
     FcStrFree (cache_hashed);
     FcAtomicUnlock (atomic);
     FcAtomicDestroy (atomic);
@@ -1086,8 +2264,8 @@ FcDirCacheClean (const FcChar8 *cache_dir, FcBool verbose)
 	    continue;
 	/* skip cache files for different architectures and */
 	/* files which are not cache files at all */
-	if (strlen(ent->d_name) != 32 + strlen ("-" FC_ARCHITECTURE FC_CACHE_SUFFIX) ||
-	    strcmp(ent->d_name + 32, "-" FC_ARCHITECTURE FC_CACHE_SUFFIX))
+	if (strlen(ent->d_name) != 32 + strlen (FC_CACHE_NAME_TAG) ||
+	    strcmp(ent->d_name + 32, FC_CACHE_NAME_TAG))
 	    continue;
 
 	file_name = FcStrBuildFilename (dir, (FcChar8 *)ent->d_name, NULL);
@@ -1196,6 +2374,7 @@ FcCacheNumFont args1(const FcCache *c)
     return FcCacheSet(c)->nfont;
 }
 
+#ifndef FC_CACHE_FAST_NAMES
 /*
  * This code implements the MD5 message-digest algorithm.
  * The algorithm is due to Ron Rivest.	This code was
@@ -1439,6 +2618,7 @@ static void MD5Transform(FcChar32 buf[4], FcChar32 in[16])
     buf[2] += c;
     buf[3] += d;
 }
+#endif /* !FC_CACHE_FAST_NAMES */
 
 FcBool
 FcDirCacheCreateTagFile (const FcChar8 *cache_dir)
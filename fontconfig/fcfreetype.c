@@ -2034,26 +2034,234 @@ FcGlyphNameToUcs4 (FcChar8 *name)
 #endif
 
 /*
- * Search through a font for a glyph by name.  This is
- * currently a linear search as there doesn't appear to be
- * any defined order within the font
+ * There doesn't appear to be any defined order of the glyph names
+ * within a font, so finding a glyph by name means reading all of
+ * them.  That is done once per face, into a hash table from name to
+ * index; the tables of the last few faces are kept until FcFini.
+ *
+ * The face belongs to the caller, so nothing is stored in it.  Faces
+ * are told apart by address, glyph count, index and PostScript name,
+ * as a face may be freed and another one created in its place.
+ */
+#define FC_GLYPHNAME_FACES  4
+
+typedef struct _FcGlyphNameTable {
+    FT_Face	    face;
+    FT_Long	    num_glyphs;
+    FT_Long	    face_index;
+    FcChar8	    *ps_name;
+    FcChar32	    mask;
+    FT_UInt	    *slots;	/* glyph index + 1, or 0 if empty */
+    int		    *names;	/* offset in pool per glyph */
+    FcChar8	    *pool;
+} FcGlyphNameTable;
+
+static FcGlyphNameTable	*fcGlyphNameTables[FC_GLYPHNAME_FACES];
+static FcMutex		*glyphname_lock;
+
+static void
+lock_glyphnames (void)
+{
+  FcMutex *lock;
+retry:
+  lock = fc_atomic_ptr_get (&glyphname_lock);
+  if (!lock) {
+    lock = (FcMutex *) malloc (sizeof (FcMutex));
+    FcMutexInit (lock);
+    if (!fc_atomic_ptr_cmpexch (&glyphname_lock, NULL, lock)) {
+      FcMutexFinish (lock);
+      goto retry;
+    }
+  }
+  FcMutexLock (lock);
+}
+
+static void
+unlock_glyphnames (void)
+{
+  FcMutexUnlock (glyphname_lock);
+}
+
+static void
+free_glyphname_lock (void)
+{
+  FcMutex *lock;
+  lock = fc_atomic_ptr_get (&glyphname_lock);
+  if (lock && fc_atomic_ptr_cmpexch (&glyphname_lock, lock, NULL)) {
+    FcMutexFinish (lock);
+    free (lock);
+  }
+}
+
+static void
+FcGlyphNameTableDestroy (FcGlyphNameTable *table)
+{
+    free (table->ps_name);
+    free (table->slots);
+    free (table->names);
+    free (table->pool);
+    free (table);
+}
+
+static FcBool
+FcGlyphNameTableMatches (const FcGlyphNameTable *table, FT_Face face, const char *ps_name)
+{
+    return table->face == face &&
+	   table->num_glyphs == face->num_glyphs &&
+	   table->face_index == face->face_index &&
+	   !strcmp ((const char *) table->ps_name, ps_name ? ps_name : "");
+}
+
+static FcGlyphNameTable *
+FcGlyphNameTableCreate (FT_Face face, const char *ps_name)
+{
+    FcGlyphNameTable	*table;
+    FcChar8		name_buf[FC_GLYPHNAME_BUFLEN + 2];
+    FT_UInt		gindex, num_glyphs = face->num_glyphs;
+    FcChar32		i, size;
+    size_t		len, used = 0, alloc = 0;
+    FcChar8		*pool;
+
+    table = calloc (1, sizeof (FcGlyphNameTable));
+    if (!table)
+	return NULL;
+    table->face = face;
+    table->num_glyphs = face->num_glyphs;
+    table->face_index = face->face_index;
+    table->ps_name = (FcChar8 *) strdup (ps_name ? ps_name : "");
+
+    /* Keep the table at most half full */
+    for (size = 16; size < 2 * num_glyphs; size <<= 1)
+	;
+    table->mask = size - 1;
+    table->slots = calloc (size, sizeof (FT_UInt));
+    table->names = malloc ((num_glyphs ? num_glyphs : 1) * sizeof (int));
+    if (!table->ps_name || !table->slots || !table->names)
+	goto bail;
+
+    for (gindex = 0; gindex < num_glyphs; gindex++)
+    {
+	table->names[gindex] = -1;
+	if (FT_Get_Glyph_Name (face, gindex, name_buf, FC_GLYPHNAME_BUFLEN+1) != 0)
+	    continue;
+	len = strlen ((char *) name_buf) + 1;
+	if (used + len > alloc)
+	{
+	    alloc = alloc ? alloc * 2 : 4096;
+	    if (alloc < used + len)
+		alloc = used + len;
+	    pool = realloc (table->pool, alloc);
+	    if (!pool)
+		goto bail;
+	    table->pool = pool;
+	}
+	memcpy (table->pool + used, name_buf, len);
+	table->names[gindex] = used;
+	used += len;
+
+	/* The first glyph with a name wins, as with a linear search */
+	for (i = FcHashGlyphName (name_buf) & table->mask;
+	     table->slots[i];
+	     i = (i + 1) & table->mask)
+	    if (!strcmp ((char *) name_buf,
+			 (char *) table->pool + table->names[table->slots[i] - 1]))
+		break;
+	if (!table->slots[i])
+	    table->slots[i] = gindex + 1;
+    }
+    return table;
+
+bail:
+    FcGlyphNameTableDestroy (table);
+    return NULL;
+}
+
+static FT_UInt
+FcGlyphNameTableLookup (const FcGlyphNameTable *table, const FcChar8 *name)
+{
+    FcChar32	i;
+
+    for (i = FcHashGlyphName (name) & table->mask;
+	 table->slots[i];
+	 i = (i + 1) & table->mask)
+	if (!strcmp ((const char *) name,
+		     (const char *) table->pool + table->names[table->slots[i] - 1]))
+	    return table->slots[i] - 1;
+    return 0;
+}
+
+/*
+ * Search through a font for a glyph by name
  */
 static FT_UInt
 FcFreeTypeGlyphNameIndex (FT_Face face, const FcChar8 *name)
 {
-    FT_UInt gindex;
-    FcChar8 name_buf[FC_GLYPHNAME_BUFLEN + 2];
+    FcGlyphNameTable	*table, *new;
+    const char		*ps_name = FT_Get_Postscript_Name (face);
+    FT_UInt		gindex;
+    FcChar8		name_buf[FC_GLYPHNAME_BUFLEN + 2];
+    int			i;
+
+    lock_glyphnames ();
+    for (i = 0; i < FC_GLYPHNAME_FACES; i++)
+    {
+	table = fcGlyphNameTables[i];
+	if (table && FcGlyphNameTableMatches (table, face, ps_name))
+	{
+	    gindex = FcGlyphNameTableLookup (table, name);
+	    unlock_glyphnames ();
+	    return gindex;
+	}
+    }
+    unlock_glyphnames ();
 
-    for (gindex = 0; gindex < (FT_UInt) face->num_glyphs; gindex++)
+    /* Read the names without holding the lock */
+    new = FcGlyphNameTableCreate (face, ps_name);
+    if (!new)
     {
-	if (FT_Get_Glyph_Name (face, gindex, name_buf, FC_GLYPHNAME_BUFLEN+1) == 0)
-	    if (!strcmp ((char *) name, (char *) name_buf))
-		return gindex;
+	for (gindex = 0; gindex < (FT_UInt) face->num_glyphs; gindex++)
+	{
+	    if (FT_Get_Glyph_Name (face, gindex, name_buf, FC_GLYPHNAME_BUFLEN+1) == 0)
+		if (!strcmp ((char *) name, (char *) name_buf))
+		    return gindex;
+	}
+	return 0;
     }
-    return 0;
+    gindex = FcGlyphNameTableLookup (new, name);
+
+    /* Keep it as the most recent table, dropping the oldest one */
+    lock_glyphnames ();
+    table = fcGlyphNameTables[FC_GLYPHNAME_FACES - 1];
+    for (i = FC_GLYPHNAME_FACES - 1; i > 0; i--)
+	fcGlyphNameTables[i] = fcGlyphNameTables[i - 1];
+    fcGlyphNameTables[0] = new;
+    unlock_glyphnames ();
+    if (table)
+	FcGlyphNameTableDestroy (table);
+
+    return gindex;
 }
 #endif
 
+/*
+ * Free the glyph name tables, from FcFini
+ */
+void
+FcFreeTypeFini (void)
+{
+#if HAVE_FT_HAS_PS_GLYPH_NAMES
+    int	    i;
+
+    for (i = 0; i < FC_GLYPHNAME_FACES; i++)
+    {
+	if (fcGlyphNameTables[i])
+	    FcGlyphNameTableDestroy (fcGlyphNameTables[i]);
+	fcGlyphNameTables[i] = NULL;
+    }
+    free_glyphname_lock ();
+#endif
+}
+
 /*
  * Map a UCS4 glyph to a glyph index.  Use all available encoding
  * tables to try and find one that works.  This information is expected
@@ -2189,6 +2397,155 @@ FcFreeTypeCheckGlyph (FT_Face face, FcChar32 ucs4,
     return FcFalse;
 }
 
+/*
+ * Checking glyphs without loading them, for TrueType outlines.  A glyph
+ * is blank exactly when its 'loca' entry is empty, and the advance is
+ * read from 'hmtx', so one read of each table replaces loading every
+ * glyph of the cmap.
+ */
+#define TTAG_loca  FT_MAKE_TAG( 'l', 'o', 'c', 'a' )
+#define TTAG_hmtx  FT_MAKE_TAG( 'h', 'm', 't', 'x' )
+
+typedef struct _FcGlyphTables {
+    FT_Byte	    *loca;
+    FT_Byte	    *hmtx;
+    FT_UInt	    num_glyphs;
+    FT_UInt	    num_hmetrics;
+    FcBool	    long_offsets;
+} FcGlyphTables;
+
+static FT_Byte *
+FcGlyphTablesLoad (FT_Face face, FT_ULong tag, FT_ULong *len)
+{
+    FT_Byte	    *table;
+
+    *len = 0;
+    if (FT_Load_Sfnt_Table (face, tag, 0, NULL, len) || !*len)
+	return NULL;
+    table = malloc (*len);
+    if (!table)
+	return NULL;
+    if (FT_Load_Sfnt_Table (face, tag, 0, table, len))
+    {
+	free (table);
+	return NULL;
+    }
+    return table;
+}
+
+static FcBool
+FcGlyphTablesInit (FT_Face face, FcGlyphTables *tables)
+{
+    TT_Header	    *head;
+    TT_HoriHeader   *hhea;
+    FT_ULong	    loca_len, hmtx_len;
+
+    tables->loca = NULL;
+    tables->hmtx = NULL;
+
+    if (!FT_IS_SFNT (face) || !(face->face_flags & FT_FACE_FLAG_SCALABLE))
+	return FcFalse;
+    head = (TT_Header *) FT_Get_Sfnt_Table (face, ft_sfnt_head);
+    hhea = (TT_HoriHeader *) FT_Get_Sfnt_Table (face, ft_sfnt_hhea);
+    if (!head || !hhea || face->num_glyphs <= 0 || hhea->number_Of_HMetrics == 0)
+	return FcFalse;
+
+    /* CFF fonts have no 'loca' and keep loading glyphs */
+    tables->loca = FcGlyphTablesLoad (face, TTAG_loca, &loca_len);
+    if (!tables->loca)
+	return FcFalse;
+    tables->hmtx = FcGlyphTablesLoad (face, TTAG_hmtx, &hmtx_len);
+    if (!tables->hmtx)
+	goto bail;
+
+    tables->num_glyphs = face->num_glyphs;
+    tables->num_hmetrics = hhea->number_Of_HMetrics;
+    tables->long_offsets = head->Index_To_Loc_Format != 0;
+    if (loca_len < (tables->num_glyphs + 1) * (tables->long_offsets ? 4 : 2) ||
+	hmtx_len < tables->num_hmetrics * 4)
+	goto bail;
+    return FcTrue;
+
+bail:
+    free (tables->loca);
+    free (tables->hmtx);
+    tables->loca = NULL;
+    tables->hmtx = NULL;
+    return FcFalse;
+}
+
+static void
+FcGlyphTablesFini (FcGlyphTables *tables)
+{
+    free (tables->loca);
+    free (tables->hmtx);
+}
+
+#define FcGlyphTablesU16(p)  ((FT_UInt32) (p)[0] << 8 | (p)[1])
+#define FcGlyphTablesU32(p)  ((FT_UInt32) (p)[0] << 24 | (FT_UInt32) (p)[1] << 16 | \
+			      (FT_UInt32) (p)[2] << 8 | (p)[3])
+
+/*
+ * Same as FcFreeTypeCheckGlyph, from the tables
+ */
+static FcBool
+FcGlyphTablesCheckGlyph (const FcGlyphTables *tables, FcChar32 ucs4,
+			 FT_UInt glyph, FcBlanks *blanks,
+			 FT_Pos *advance)
+{
+    FT_UInt32	    start, end;
+    FT_UInt	    metric;
+
+    if (!glyph || glyph >= tables->num_glyphs)
+	return FcFalse;
+
+    metric = glyph < tables->num_hmetrics ? glyph : tables->num_hmetrics - 1;
+    *advance = FcGlyphTablesU16 (tables->hmtx + metric * 4);
+
+    if (tables->long_offsets)
+    {
+	start = FcGlyphTablesU32 (tables->loca + glyph * 4);
+	end = FcGlyphTablesU32 (tables->loca + glyph * 4 + 4);
+    }
+    else
+    {
+	start = FcGlyphTablesU16 (tables->loca + glyph * 2);
+	end = FcGlyphTablesU16 (tables->loca + glyph * 2 + 2);
+    }
+    if (end > start)
+	return FcTrue;
+    /* A glyph without outline, as in FcFreeTypeCheckGlyph */
+    return !blanks || FcBlanksIsMember (blanks, ucs4);
+}
+
+/*
+ * Check a glyph from the tables if there are any, by loading it
+ * otherwise.  CHECK builds load it anyway and report any difference.
+ */
+static FcBool
+FcFreeTypeCheckGlyphFrom (FT_Face face, const FcGlyphTables *tables,
+			  FcChar32 ucs4, FT_UInt glyph, FcBlanks *blanks,
+			  FT_Pos *advance, FcBool using_strike)
+{
+    FcBool	    ret;
+#ifdef CHECK
+    FT_Pos	    ft_advance = 0;
+    FcBool	    ft_ret;
+#endif
+
+    if (!tables)
+	return FcFreeTypeCheckGlyph (face, ucs4, glyph, blanks, advance, using_strike);
+
+    ret = FcGlyphTablesCheckGlyph (tables, ucs4, glyph, blanks, advance);
+#ifdef CHECK
+    ft_ret = FcFreeTypeCheckGlyph (face, ucs4, glyph, blanks, &ft_advance, using_strike);
+    if (ret != ft_ret || (ret && *advance != ft_advance))
+	printf ("0x%08x glyph %u tables say %d advance %ld FT says %d advance %ld\n",
+		ucs4, glyph, ret, (long) *advance, ft_ret, (long) ft_advance);
+#endif
+    return ret;
+}
+
 #define APPROXIMATELY_EQUAL(x,y) (FC_ABS ((x) - (y)) <= FC_MAX (FC_ABS (x), FC_ABS (y)) / 33)
 
 static FcCharSet *
@@ -2205,6 +2562,8 @@ FcFreeTypeCharSetAndSpacingForSize (FT_Face face, FcBlanks *blanks, int *spacing
     FT_Pos	    advance, advance_one = 0, advance_two = 0;
     FcBool	    has_advance = FcFalse, fixed_advance = FcTrue, dual_advance = FcFalse;
     FcBool	    using_strike = FcFalse;
+    FcGlyphTables   tables;
+    FcBool	    use_tables = FcFalse;
 
     fcs = FcCharSetCreate ();
     if (!fcs)
@@ -2218,6 +2577,8 @@ FcFreeTypeCharSetAndSpacingForSize (FT_Face face, FcBlanks *blanks, int *spacing
     }
 #endif
 
+    /* Bitmap strikes have to be checked glyph by glyph */
+    use_tables = !using_strike && FcGlyphTablesInit (face, &tables);
 #ifdef CHECK
     printf ("Family %s style %s\n", face->family_name, face->style_name);
 #endif
@@ -2232,7 +2593,8 @@ FcFreeTypeCharSetAndSpacingForSize (FT_Face face, FcBlanks *blanks, int *spacing
             ucs4 = FT_Get_First_Char (face, &glyph);
             while (glyph != 0)
 	    {
-		if (FcFreeTypeCheckGlyph (face, ucs4, glyph, blanks, &advance, using_strike))
+		if (FcFreeTypeCheckGlyphFrom (face, use_tables ? &tables : NULL,
+					      ucs4, glyph, blanks, &advance, using_strike))
 		{
 		    if (advance)
 		    {
@@ -2318,7 +2680,8 @@ FcFreeTypeCharSetAndSpacingForSize (FT_Face face, FcBlanks *blanks, int *spacing
 	    {
 		ucs4 = FcGlyphNameToUcs4 (name_buf);
 		if (ucs4 != 0xffff &&
-		    FcFreeTypeCheckGlyph (face, ucs4, glyph, blanks, &advance, using_strike))
+		    FcFreeTypeCheckGlyphFrom (face, use_tables ? &tables : NULL,
+					      ucs4, glyph, blanks, &advance, using_strike))
 		{
 		    if (advance)
 		    {
@@ -2370,6 +2733,8 @@ FcFreeTypeCharSetAndSpacingForSize (FT_Face face, FcBlanks *blanks, int *spacing
 	    printf ("Bitmap extra char 0x%x\n", ucs4);
     }
 #endif
+    if (use_tables)
+	FcGlyphTablesFini (&tables);
     if (fixed_advance)
 	*spacing = FC_MONO;
     else if (dual_advance && APPROXIMATELY_EQUAL (2 * FC_MIN (advance_one, advance_two), FC_MAX (advance_one, advance_two)))
@@ -2378,6 +2743,8 @@ FcFreeTypeCharSetAndSpacingForSize (FT_Face face, FcBlanks *blanks, int *spacing
 	*spacing = FC_PROPORTIONAL;
     return fcs;
 bail1:
+    if (use_tables)
+	FcGlyphTablesFini (&tables);
     FcCharSetDestroy (fcs);
 bail0:
     return 0;
@@ -1,7 +1,8 @@
 /*
- * hash.c: chained hash tables
+ * hash.c: open addressing hash tables
  *
  * Reference: Your favorite introductory book on algorithms
+ *            Celis, "Robin Hood Hashing", 1986
  *
  * Copyright (C) 2000,2012 Bjorn Reese and Daniel Veillard.
  *
@@ -27,6 +28,15 @@
 #ifdef HAVE_TIME_H
 #include <time.h>
 #endif
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#else
+#ifdef HAVE_INTTYPES_H
+#include <inttypes.h>
+#elif defined(WIN32)
+typedef unsigned __int32 uint32_t;
+#endif
+#endif
 
 /*
  * Following http://www.ocert.org/advisories/ocert-2011-003.html
@@ -42,8 +52,43 @@
 #include <libxml/xmlmemory.h>
 #include <libxml/xmlerror.h>
 #include <libxml/globals.h>
+#include <libxml/threads.h>
+
+#define MIN_HASH_SIZE 8
+#define MAX_HASH_SIZE (1U << 30)
+
+/*
+ * Maximum fill factor is MAX_FILL_NUM / MAX_FILL_DENOM
+ */
+#define MAX_FILL_NUM 7
+#define MAX_FILL_DENOM 8
+
+/*
+ * A hash value of zero marks an empty slot, stored values always have
+ * the top bit set.
+ */
+#define HASH_VALID_BIT 0x80000000U
 
-#define MAX_HASH_LEN 8
+/*
+ * Number of recently found entries remembered by dict-backed tables
+ */
+#define HASH_MEMO_SIZE 64
+
+/*
+ * Lookups on concurrent tables are lock-free where the compiler provides
+ * the __atomic builtins, otherwise they take the writer lock.
+ */
+#if defined(__ATOMIC_ACQUIRE) && defined(__ATOMIC_RELEASE)
+#define HASH_LOCK_FREE_READS
+#define HASH_LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define HASH_LOAD_RELAXED(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define HASH_STORE_RELAXED(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define HASH_STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define HASH_FENCE_ACQUIRE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define HASH_FENCE_RELEASE() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define HASH_FENCE_FULL() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define HASH_ADD(p, v) __atomic_add_fetch((p), (v), __ATOMIC_RELEASE)
+#endif
 
 /* #define DEBUG_GROW */
 
@@ -53,113 +98,666 @@
 typedef struct _xmlHashEntry xmlHashEntry;
 typedef xmlHashEntry *xmlHashEntryPtr;
 struct _xmlHashEntry {
-    struct _xmlHashEntry *next;
+    uint32_t hashValue;
     xmlChar *name;
     xmlChar *name2;
     xmlChar *name3;
     void *payload;
-    int valid;
 };
 
 /*
  * The entire hash table
+ *
+ * Entries are stored inline with open addressing and linear probing.
+ * Insertions use Robin Hood hashing: an entry that is further away from
+ * its home slot takes the place of one that is closer, which keeps probe
+ * sequences short and lets lookups stop early. The stored hash value is
+ * compared before the names, so most probes never touch the key strings.
  */
 struct _xmlHashTable {
     struct _xmlHashEntry *table;
-    int size;
+    unsigned int size;
     int nbElems;
     xmlDictPtr dict;
+    unsigned int *memo;
 #ifdef HASH_RANDOMIZATION
-    int random_seed;
+    uint32_t random_seed[2];
 #endif
+    /* concurrent mode, see xmlHashSetConcurrent() */
+    int concurrent;
+    xmlRMutexPtr lock;          /* serializes writers */
+    unsigned int seq;           /* odd while a writer moves entries */
+    int readers;                /* lookups in progress */
+    void **retired;             /* memory readers may still look at */
+    int nbRetired;
+    int maxRetired;
 };
 
 /*
- * xmlHashComputeKey:
- * Calculate the hash key
+ * Keys are hashed with HalfSipHash-1-3, the 32 bit variant of SipHash:
+ * it consumes the names four bytes per step using only 32 bit
+ * arithmetic, and with HASH_RANDOMIZATION the per table random key
+ * makes collisions unpredictable for untrusted documents.
+ *
+ * Reference: Aumasson and Bernstein, "SipHash: a fast short-input PRF"
  */
-static unsigned long
-xmlHashComputeKey(xmlHashTablePtr table, const xmlChar *name,
-	          const xmlChar *name2, const xmlChar *name3) {
-    unsigned long value = 0L;
-    char ch;
+typedef struct _xmlHashState xmlHashState;
+struct _xmlHashState {
+    uint32_t v0, v1, v2, v3;
+    uint32_t tail;              /* pending bytes, little endian */
+    uint32_t len;               /* number of bytes hashed */
+};
+
+#define HASH_ROTL(x, b) (uint32_t) (((x) << (b)) | ((x) >> (32 - (b))))
+
+#define HASH_SIPROUND(st)                                               \
+    do {                                                                \
+        (st)->v0 += (st)->v1;                                           \
+        (st)->v1 = HASH_ROTL((st)->v1, 5);                              \
+        (st)->v1 ^= (st)->v0;                                           \
+        (st)->v0 = HASH_ROTL((st)->v0, 16);                             \
+        (st)->v2 += (st)->v3;                                           \
+        (st)->v3 = HASH_ROTL((st)->v3, 8);                              \
+        (st)->v3 ^= (st)->v2;                                           \
+        (st)->v0 += (st)->v3;                                           \
+        (st)->v3 = HASH_ROTL((st)->v3, 7);                              \
+        (st)->v3 ^= (st)->v0;                                           \
+        (st)->v2 += (st)->v1;                                           \
+        (st)->v1 = HASH_ROTL((st)->v1, 13);                             \
+        (st)->v1 ^= (st)->v2;                                           \
+        (st)->v2 = HASH_ROTL((st)->v2, 16);                             \
+    } while (0)
+
+/*
+ * Compilers turn this into a single load on little endian targets
+ */
+#define HASH_LOAD32(p)                                                  \
+    ((uint32_t) (p)[0] | ((uint32_t) (p)[1] << 8) |                     \
+     ((uint32_t) (p)[2] << 16) | ((uint32_t) (p)[3] << 24))
+
+static void
+xmlHashStateInit(xmlHashState *st, xmlHashTablePtr table) {
+    uint32_t k0 = 0, k1 = 0;
 
 #ifdef HASH_RANDOMIZATION
-    value = table->random_seed;
+    k0 = table->random_seed[0];
+    k1 = table->random_seed[1];
+#else
+    (void) table;
 #endif
-    if (name != NULL) {
-	value += 30 * (*name);
-	while ((ch = *name++) != 0) {
-	    value = value ^ ((value << 5) + (value >> 3) + (unsigned long)ch);
-	}
+    st->v0 = k0;
+    st->v1 = k1;
+    st->v2 = 0x6c796765 ^ k0;
+    st->v3 = 0x74656462 ^ k1;
+    st->tail = 0;
+    st->len = 0;
+}
+
+static void
+xmlHashStateWord(xmlHashState *st, uint32_t m) {
+    st->v3 ^= m;
+    HASH_SIPROUND(st);
+    st->v0 ^= m;
+}
+
+static void
+xmlHashStateByte(xmlHashState *st, xmlChar ch) {
+    st->tail |= (uint32_t) ch << (8 * (st->len & 3));
+    st->len++;
+    if ((st->len & 3) == 0) {
+        xmlHashStateWord(st, st->tail);
+        st->tail = 0;
     }
-    value = value ^ ((value << 5) + (value >> 3));
-    if (name2 != NULL) {
-	while ((ch = *name2++) != 0) {
-	    value = value ^ ((value << 5) + (value >> 3) + (unsigned long)ch);
-	}
+}
+
+/*
+ * xmlHashStateString:
+ * Feed a string to the hash. Strings are hashed as one byte stream, so
+ * "a:b" and the pieces "a", ':' and "b" give the same result.
+ */
+static void
+xmlHashStateString(xmlHashState *st, const xmlChar *str) {
+    size_t len;
+
+    if (str == NULL)
+        return;
+    len = strlen((const char *) str);
+
+    /* Complete the word left over by the previous piece */
+    while (((st->len & 3) != 0) && (len > 0)) {
+        xmlHashStateByte(st, *str++);
+        len--;
     }
-    value = value ^ ((value << 5) + (value >> 3));
-    if (name3 != NULL) {
-	while ((ch = *name3++) != 0) {
-	    value = value ^ ((value << 5) + (value >> 3) + (unsigned long)ch);
-	}
+    while (len >= 4) {
+        xmlHashStateWord(st, HASH_LOAD32(str));
+        st->len += 4;
+        str += 4;
+        len -= 4;
+    }
+    while (len > 0) {
+        xmlHashStateByte(st, *str++);
+        len--;
     }
-    return (value % table->size);
 }
 
-static unsigned long
+static uint32_t
+xmlHashStateFinal(xmlHashState *st) {
+    uint32_t b = (st->len << 24) | st->tail;
+
+    st->v3 ^= b;
+    HASH_SIPROUND(st);
+    st->v0 ^= b;
+    st->v2 ^= 0xff;
+    HASH_SIPROUND(st);
+    HASH_SIPROUND(st);
+    HASH_SIPROUND(st);
+    return(st->v1 ^ st->v3);
+}
+
+/*
+ * xmlHashComputeKey:
+ * Calculate the hash value, the table index is taken from its low bits
+ */
+static uint32_t
+xmlHashComputeKey(xmlHashTablePtr table, const xmlChar *name,
+	          const xmlChar *name2, const xmlChar *name3) {
+    xmlHashState st;
+
+    xmlHashStateInit(&st, table);
+    xmlHashStateString(&st, name);
+    xmlHashStateByte(&st, 0);
+    xmlHashStateString(&st, name2);
+    xmlHashStateByte(&st, 0);
+    xmlHashStateString(&st, name3);
+    return(xmlHashStateFinal(&st) | HASH_VALID_BIT);
+}
+
+/*
+ * xmlHashComputeQKey:
+ * Calculate the hash value of the QNames tuple, which is the same as
+ * the one of the names "prefix:name" computed by xmlHashComputeKey
+ */
+static uint32_t
 xmlHashComputeQKey(xmlHashTablePtr table,
 		   const xmlChar *prefix, const xmlChar *name,
 		   const xmlChar *prefix2, const xmlChar *name2,
 		   const xmlChar *prefix3, const xmlChar *name3) {
-    unsigned long value = 0L;
-    char ch;
+    xmlHashState st;
 
-#ifdef HASH_RANDOMIZATION
-    value = table->random_seed;
+    xmlHashStateInit(&st, table);
+    if (prefix != NULL) {
+        xmlHashStateString(&st, prefix);
+        xmlHashStateByte(&st, ':');
+    }
+    xmlHashStateString(&st, name);
+    xmlHashStateByte(&st, 0);
+    if (prefix2 != NULL) {
+        xmlHashStateString(&st, prefix2);
+        xmlHashStateByte(&st, ':');
+    }
+    xmlHashStateString(&st, name2);
+    xmlHashStateByte(&st, 0);
+    if (prefix3 != NULL) {
+        xmlHashStateString(&st, prefix3);
+        xmlHashStateByte(&st, ':');
+    }
+    xmlHashStateString(&st, name3);
+    return(xmlHashStateFinal(&st) | HASH_VALID_BIT);
+}
+
+/*
+ * xmlHashEntryMatch:
+ * Check whether @entry holds the (@name, @name2, @name3) tuple. If the
+ * names are @interned in the table dict, pointer equality decides.
+ */
+static int
+xmlHashEntryMatch(xmlHashEntryPtr entry, const xmlChar *name,
+                  const xmlChar *name2, const xmlChar *name3,
+                  int interned) {
+    if (interned)
+        return((entry->name == name) &&
+               (entry->name2 == name2) &&
+               (entry->name3 == name3));
+    return((xmlStrEqual(entry->name, name)) &&
+           (xmlStrEqual(entry->name2, name2)) &&
+           (xmlStrEqual(entry->name3, name3)));
+}
+
+/*
+ * Concurrent tables
+ *
+ * Writers are serialized by the table lock. Readers do not lock at all:
+ * a sequence counter, odd while a writer moves entries around, tells them
+ * whether what they read may be torn, in which case they simply try again
+ * (a seqlock). Readers can thus look at slots, names and entry arrays a
+ * writer has just dropped, so instead of being freed those are retired.
+ * Lookups are counted, and the retired memory is released by the next
+ * writer that finds none in progress: lookups starting after that only
+ * see what is still in the table.
+ */
+
+/*
+ * xmlHashLock:
+ * Take the writer lock of a concurrent @table
+ */
+static void
+xmlHashLock(xmlHashTablePtr table) {
+    if (table->concurrent)
+        xmlRMutexLock(table->lock);
+}
+
+/*
+ * xmlHashUnlock:
+ * Release the writer lock of a concurrent @table
+ */
+static void
+xmlHashUnlock(xmlHashTablePtr table) {
+    if (table->concurrent)
+        xmlRMutexUnlock(table->lock);
+}
+
+/*
+ * xmlHashWriteBegin:
+ * Start moving entries of a concurrent @table, with the lock held
+ */
+static void
+xmlHashWriteBegin(xmlHashTablePtr table) {
+#ifdef HASH_LOCK_FREE_READS
+    if (table->concurrent) {
+        HASH_STORE_RELAXED(&table->seq, table->seq + 1);
+        HASH_FENCE_RELEASE();
+    }
+#else
+    (void) table;
 #endif
-    if (prefix != NULL)
-	value += 30 * (*prefix);
-    else
-	value += 30 * (*name);
+}
 
-    if (prefix != NULL) {
-	while ((ch = *prefix++) != 0) {
-	    value = value ^ ((value << 5) + (value >> 3) + (unsigned long)ch);
-	}
-	value = value ^ ((value << 5) + (value >> 3) + (unsigned long)':');
+/*
+ * xmlHashWriteEnd:
+ * Make the entries moved since xmlHashWriteBegin() visible to readers
+ */
+static void
+xmlHashWriteEnd(xmlHashTablePtr table) {
+#ifdef HASH_LOCK_FREE_READS
+    if (table->concurrent)
+        HASH_STORE_RELEASE(&table->seq, table->seq + 1);
+#else
+    (void) table;
+#endif
+}
+
+/*
+ * xmlHashReadEnter:
+ * Announce a lookup in a concurrent @table to writers
+ */
+static void
+xmlHashReadEnter(xmlHashTablePtr table) {
+#ifdef HASH_LOCK_FREE_READS
+    HASH_ADD(&table->readers, 1);
+    HASH_FENCE_FULL();
+#else
+    (void) table;
+#endif
+}
+
+/*
+ * xmlHashReadLeave:
+ * End a lookup announced by xmlHashReadEnter()
+ */
+static void
+xmlHashReadLeave(xmlHashTablePtr table) {
+#ifdef HASH_LOCK_FREE_READS
+    HASH_ADD(&table->readers, -1);
+#else
+    (void) table;
+#endif
+}
+
+/*
+ * xmlHashReadBegin:
+ * Start a lookup in a concurrent @table, waiting for a running writer
+ *
+ * Returns the sequence to pass to xmlHashReadRetry()
+ */
+static unsigned int
+xmlHashReadBegin(xmlHashTablePtr table) {
+#ifdef HASH_LOCK_FREE_READS
+    unsigned int seq;
+
+    while ((seq = HASH_LOAD_ACQUIRE(&table->seq)) & 1)
+        ;
+    return(seq);
+#else
+    xmlRMutexLock(table->lock);
+    return(0);
+#endif
+}
+
+/*
+ * xmlHashReadRetry:
+ * End a lookup in a concurrent @table
+ *
+ * Returns 1 if a writer interfered and the lookup must be done again
+ */
+static int
+xmlHashReadRetry(xmlHashTablePtr table, unsigned int seq) {
+#ifdef HASH_LOCK_FREE_READS
+    HASH_FENCE_ACQUIRE();
+    return(HASH_LOAD_RELAXED(&table->seq) != seq);
+#else
+    (void) seq;
+    xmlRMutexUnlock(table->lock);
+    return(0);
+#endif
+}
+
+/*
+ * xmlHashFreeRetired:
+ * Release the memory retired from @table
+ */
+static void
+xmlHashFreeRetired(xmlHashTablePtr table) {
+    int i;
+
+    for (i = 0; i < table->nbRetired; i++)
+        xmlFree(table->retired[i]);
+    table->nbRetired = 0;
+}
+
+/*
+ * xmlHashRetire:
+ * Free memory dropped from @table, or keep it while concurrent readers
+ * may still look at it. Called after the memory has been unlinked.
+ */
+static void
+xmlHashRetire(xmlHashTablePtr table, void *mem) {
+    void **tmp;
+    int max;
+
+    if (mem == NULL)
+        return;
+#ifdef HASH_LOCK_FREE_READS
+    if (table->concurrent) {
+        if (table->nbRetired >= table->maxRetired) {
+            max = (table->maxRetired > 0) ? table->maxRetired * 2 : 16;
+            tmp = xmlRealloc(table->retired, max * sizeof(void *));
+            if (tmp == NULL)
+                return; /* leak rather than free under a reader */
+            table->retired = tmp;
+            table->maxRetired = max;
+        }
+        table->retired[table->nbRetired++] = mem;
+
+        /*
+         * Pairs with the fence in xmlHashReadEnter(): a lookup not
+         * counted yet will not find anything retired so far.
+         */
+        HASH_FENCE_FULL();
+        if (HASH_LOAD_RELAXED(&table->readers) == 0)
+            xmlHashFreeRetired(table);
+        return;
     }
-    if (name != NULL) {
-	while ((ch = *name++) != 0) {
-	    value = value ^ ((value << 5) + (value >> 3) + (unsigned long)ch);
-	}
+#else
+    (void) tmp;
+    (void) max;
+#endif
+    xmlFree(mem);
+}
+
+/*
+ * xmlHashEntries:
+ * Get the entry array of @table and its index mask. Grow publishes a
+ * new array before its size, so a concurrent reader never pairs the
+ * new, larger size with the old array.
+ */
+static xmlHashEntryPtr
+xmlHashEntries(xmlHashTablePtr table, unsigned int *mask) {
+#ifdef HASH_LOCK_FREE_READS
+    if (table->concurrent) {
+        *mask = HASH_LOAD_ACQUIRE(&table->size) - 1;
+        return(HASH_LOAD_ACQUIRE(&table->table));
     }
-    value = value ^ ((value << 5) + (value >> 3));
-    if (prefix2 != NULL) {
-	while ((ch = *prefix2++) != 0) {
-	    value = value ^ ((value << 5) + (value >> 3) + (unsigned long)ch);
-	}
-	value = value ^ ((value << 5) + (value >> 3) + (unsigned long)':');
+#endif
+    *mask = table->size - 1;
+    return(table->table);
+}
+
+/*
+ * xmlHashFindEntry:
+ * Probe for the (@name, @name2, @name3) tuple with hash value @hashValue,
+ * comparing names by pointer only if they are @interned. If the tuple is
+ * not present and @pos is not NULL, @pos and @dist are set to the slot
+ * where a new entry should be inserted and its distance from the home
+ * slot.
+ *
+ * Returns the entry or NULL if not found
+ */
+static xmlHashEntryPtr
+xmlHashFindEntry(xmlHashTablePtr table, uint32_t hashValue,
+                 const xmlChar *name, const xmlChar *name2,
+                 const xmlChar *name3, int interned,
+                 unsigned int *pos, unsigned int *dist) {
+    unsigned int mask;
+    xmlHashEntryPtr entries = xmlHashEntries(table, &mask);
+    unsigned int i = hashValue & mask;
+    unsigned int d = 0;
+    xmlHashEntryPtr entry;
+
+    while (1) {
+        entry = &(entries[i]);
+        /*
+         * An empty slot, or an entry closer to its home slot than we are
+         * to ours, ends the probe sequence: Robin Hood insertion would
+         * have placed the tuple here. The distance bound only matters to
+         * concurrent readers seeing a table in the middle of a change.
+         */
+        if ((entry->hashValue == 0) ||
+            (((i - entry->hashValue) & mask) < d) || (d > mask))
+            break;
+        if ((entry->hashValue == hashValue) &&
+            (xmlHashEntryMatch(entry, name, name2, name3, interned)))
+            return(entry);
+        i = (i + 1) & mask;
+        d++;
     }
-    if (name2 != NULL) {
-	while ((ch = *name2++) != 0) {
-	    value = value ^ ((value << 5) + (value >> 3) + (unsigned long)ch);
-	}
+
+    if (pos != NULL) {
+        *pos = i;
+        *dist = d;
     }
-    value = value ^ ((value << 5) + (value >> 3));
-    if (prefix3 != NULL) {
-	while ((ch = *prefix3++) != 0) {
-	    value = value ^ ((value << 5) + (value >> 3) + (unsigned long)ch);
-	}
-	value = value ^ ((value << 5) + (value >> 3) + (unsigned long)':');
+    return(NULL);
+}
+
+/*
+ * xmlHashInsertEntry:
+ * Store a copy of @entry in the @entries array of @mask + 1 slots,
+ * starting at slot @pos which is @dist slots away from its home slot.
+ * Entries closer to their home slot are displaced further down the probe
+ * sequence. There must be a free slot.
+ */
+static void
+xmlHashInsertEntry(xmlHashEntryPtr entries, unsigned int mask,
+                   unsigned int pos, unsigned int dist,
+                   const xmlHashEntry *entry) {
+    unsigned int slotDist;
+    xmlHashEntry cur, tmp;
+    xmlHashEntryPtr slot;
+
+    cur = *entry;
+    while (1) {
+        slot = &(entries[pos]);
+        if (slot->hashValue == 0) {
+            *slot = cur;
+            return;
+        }
+        slotDist = (pos - slot->hashValue) & mask;
+        if (slotDist < dist) {
+            tmp = *slot;
+            *slot = cur;
+            cur = tmp;
+            dist = slotDist;
+        }
+        pos = (pos + 1) & mask;
+        dist++;
     }
-    if (name3 != NULL) {
-	while ((ch = *name3++) != 0) {
-	    value = value ^ ((value << 5) + (value >> 3) + (unsigned long)ch);
-	}
+}
+
+/*
+ * xmlHashNeedGrow:
+ * Check whether adding one more entry exceeds the maximum fill factor
+ */
+static int
+xmlHashNeedGrow(xmlHashTablePtr table) {
+    return((unsigned int) table->nbElems + 1 >
+           table->size / MAX_FILL_DENOM * MAX_FILL_NUM);
+}
+
+/*
+ * xmlHashMemoIndex:
+ * Slot of the memo for a tuple of name pointers
+ */
+static unsigned int
+xmlHashMemoIndex(const xmlChar *name, const xmlChar *name2,
+                 const xmlChar *name3) {
+    size_t value;
+
+    value = (size_t) name ^ ((size_t) name2 >> 5) ^ ((size_t) name3 >> 9);
+    return((((unsigned int) (value >> 3)) * 2654435761U) >>
+           (32 - 6)) & (HASH_MEMO_SIZE - 1);
+}
+
+/*
+ * xmlHashMemoize:
+ * Remember that the entry in @slot holds the (@name, @name2, @name3)
+ * tuple. Only done by writers, lookups never modify the table.
+ */
+static void
+xmlHashMemoize(xmlHashTablePtr table, const xmlChar *name,
+               const xmlChar *name2, const xmlChar *name3,
+               unsigned int slot) {
+    if (table->memo != NULL)
+        table->memo[xmlHashMemoIndex(name, name2, name3)] = slot;
+}
+
+/*
+ * xmlHashLookupEntry:
+ * Find the entry for the (@name, @name2, @name3) tuple.
+ *
+ * Entries of a dict-backed table hold interned names, and callers mostly
+ * look them up with the same interned pointers again and again. Such
+ * tables remember where entries were stored, keyed by the name pointers.
+ * An entry whose names are the very same pointers is the one looked for,
+ * so a memo hit needs neither hashing nor string compares. A stale memo
+ * slot simply fails that check.
+ */
+static xmlHashEntryPtr
+xmlHashLookupEntry(xmlHashTablePtr table, const xmlChar *name,
+                   const xmlChar *name2, const xmlChar *name3,
+                   int interned) {
+    xmlHashEntryPtr entry;
+    unsigned int slot;
+
+    if (table->memo != NULL) {
+        slot = table->memo[xmlHashMemoIndex(name, name2, name3)];
+        if (slot < table->size) {
+            entry = &(table->table[slot]);
+            if ((entry->hashValue != 0) && (entry->name == name) &&
+                (entry->name2 == name2) && (entry->name3 == name3))
+                return(entry);
+        }
     }
-    return (value % table->size);
+
+    return(xmlHashFindEntry(table,
+                            xmlHashComputeKey(table, name, name2, name3),
+                            name, name2, name3, interned, NULL, NULL));
+}
+
+/*
+ * xmlHashFindQEntry:
+ * Probe for the QNames tuple with hash value @hashValue
+ *
+ * Returns the entry or NULL if not found
+ */
+static xmlHashEntryPtr
+xmlHashFindQEntry(xmlHashTablePtr table, uint32_t hashValue,
+                  const xmlChar *prefix, const xmlChar *name,
+                  const xmlChar *prefix2, const xmlChar *name2,
+                  const xmlChar *prefix3, const xmlChar *name3) {
+    unsigned int mask, i, d;
+    xmlHashEntryPtr entries, entry;
+
+    entries = xmlHashEntries(table, &mask);
+    for (i = hashValue & mask, d = 0; d <= mask; i = (i + 1) & mask, d++) {
+        entry = &(entries[i]);
+        if ((entry->hashValue == 0) ||
+            (((i - entry->hashValue) & mask) < d))
+            break;
+	if ((entry->hashValue == hashValue) &&
+	    (xmlStrQEqual(prefix, name, entry->name)) &&
+	    (xmlStrQEqual(prefix2, name2, entry->name2)) &&
+	    (xmlStrQEqual(prefix3, name3, entry->name3)))
+	    return(entry);
+    }
+    return(NULL);
+}
+
+/*
+ * xmlHashReadPayload:
+ * Find the userdata of a tuple in a concurrent @table. Plain tuples are
+ * probed with xmlHashFindEntry(), QNames tuples (@qname) with
+ * xmlHashFindQEntry(). The probe runs inside a single
+ * xmlHashReadEnter()/xmlHashReadLeave() pair, so writers keep arrays it
+ * may still be reading, and is done again if a writer moved entries
+ * meanwhile.
+ */
+static void *
+xmlHashReadPayload(xmlHashTablePtr table, uint32_t hashValue, int qname,
+                   const xmlChar *prefix, const xmlChar *name,
+                   const xmlChar *prefix2, const xmlChar *name2,
+                   const xmlChar *prefix3, const xmlChar *name3,
+                   int interned) {
+    xmlHashEntryPtr entry;
+    unsigned int seq;
+    void *payload;
+
+    xmlHashReadEnter(table);
+    do {
+        seq = xmlHashReadBegin(table);
+        if (qname)
+            entry = xmlHashFindQEntry(table, hashValue, prefix, name,
+                                      prefix2, name2, prefix3, name3);
+        else
+            entry = xmlHashFindEntry(table, hashValue, name, name2, name3,
+                                     interned, NULL, NULL);
+        payload = (entry != NULL) ? entry->payload : NULL;
+    } while (xmlHashReadRetry(table, seq));
+    xmlHashReadLeave(table);
+    return(payload);
+}
+
+/*
+ * xmlHashLookupPayload:
+ * Find the userdata of the (@name, @name2, @name3) tuple, see
+ * xmlHashLookupEntry(). Lookups in a concurrent table leave out the memo,
+ * which writers update without bumping the sequence.
+ */
+static void *
+xmlHashLookupPayload(xmlHashTablePtr table, const xmlChar *name,
+                     const xmlChar *name2, const xmlChar *name3,
+                     int interned) {
+    xmlHashEntryPtr entry;
+
+    if (!table->concurrent) {
+        entry = xmlHashLookupEntry(table, name, name2, name3, interned);
+        if (entry == NULL)
+            return(NULL);
+        return(entry->payload);
+    }
+
+    return(xmlHashReadPayload(table,
+                              xmlHashComputeKey(table, name, name2, name3),
+                              0, NULL, name, NULL, name2, NULL, name3,
+                              interned));
 }
 
 /**
@@ -173,20 +771,40 @@ xmlHashComputeQKey(xmlHashTablePtr table,
 xmlHashTablePtr
 xmlHashCreate(int size) {
     xmlHashTablePtr table;
+    unsigned int tableSize;
 
     if (size <= 0)
         size = 256;
+    if ((unsigned int) size > MAX_HASH_SIZE)
+        size = MAX_HASH_SIZE;
+
+    /*
+     * The table index is taken from the low bits of the hash value,
+     * so the size is a power of two.
+     */
+    tableSize = MIN_HASH_SIZE;
+    while (tableSize < (unsigned int) size)
+        tableSize *= 2;
 
     table = xmlMalloc(sizeof(xmlHashTable));
     if (table) {
         table->dict = NULL;
-        table->size = size;
+        table->memo = NULL;
+        table->concurrent = 0;
+        table->lock = NULL;
+        table->seq = 0;
+        table->readers = 0;
+        table->retired = NULL;
+        table->nbRetired = 0;
+        table->maxRetired = 0;
+        table->size = tableSize;
 	table->nbElems = 0;
-        table->table = xmlMalloc(size * sizeof(xmlHashEntry));
+        table->table = xmlMalloc(tableSize * sizeof(xmlHashEntry));
         if (table->table) {
-	    memset(table->table, 0, size * sizeof(xmlHashEntry));
+	    memset(table->table, 0, tableSize * sizeof(xmlHashEntry));
 #ifdef HASH_RANDOMIZATION
-            table->random_seed = __xmlRandom();
+            table->random_seed[0] = __xmlRandom();
+            table->random_seed[1] = __xmlRandom();
 #endif
 	    return(table);
         }
@@ -212,6 +830,12 @@ xmlHashCreateDict(int size, xmlDictPtr dict) {
     if (table != NULL) {
         table->dict = dict;
 	xmlDictReference(dict);
+        /*
+         * Optional: without the memo lookups just always probe.
+         */
+        table->memo = xmlMalloc(HASH_MEMO_SIZE * sizeof(unsigned int));
+        if (table->memo != NULL)
+            memset(table->memo, 0xFF, HASH_MEMO_SIZE * sizeof(unsigned int));
     }
     return(table);
 }
@@ -226,20 +850,18 @@ xmlHashCreateDict(int size, xmlDictPtr dict) {
  * Returns 0 in case of success, -1 in case of failure
  */
 static int
-xmlHashGrow(xmlHashTablePtr table, int size) {
-    unsigned long key;
-    int oldsize, i;
-    xmlHashEntryPtr iter, next;
-    struct _xmlHashEntry *oldtable;
+xmlHashGrow(xmlHashTablePtr table, unsigned int size) {
+    unsigned int oldsize, i;
+    struct _xmlHashEntry *oldtable, *newtable;
 #ifdef DEBUG_GROW
     unsigned long nbElem = 0;
 #endif
 
     if (table == NULL)
 	return(-1);
-    if (size < 8)
+    if (size < MIN_HASH_SIZE)
         return(-1);
-    if (size > 8 * 2048)
+    if (size > MAX_HASH_SIZE)
 	return(-1);
 
     oldsize = table->size;
@@ -247,58 +869,44 @@ xmlHashGrow(xmlHashTablePtr table, int size) {
     if (oldtable == NULL)
         return(-1);
 
-    table->table = xmlMalloc(size * sizeof(xmlHashEntry));
-    if (table->table == NULL) {
-	table->table = oldtable;
+    newtable = xmlMalloc(size * sizeof(xmlHashEntry));
+    if (newtable == NULL)
 	return(-1);
-    }
-    memset(table->table, 0, size * sizeof(xmlHashEntry));
-    table->size = size;
-
-    /*	If the two loops are merged, there would be situations where
-	a new entry needs to allocated and data copied into it from
-	the main table. So instead, we run through the array twice, first
-	copying all the elements in the main array (where we can't get
-	conflicts) and then the rest, so we only free (and don't allocate)
-    */
-    for (i = 0; i < oldsize; i++) {
-	if (oldtable[i].valid == 0)
-	    continue;
-	key = xmlHashComputeKey(table, oldtable[i].name, oldtable[i].name2,
-				oldtable[i].name3);
-	memcpy(&(table->table[key]), &(oldtable[i]), sizeof(xmlHashEntry));
-	table->table[key].next = NULL;
-    }
+    memset(newtable, 0, size * sizeof(xmlHashEntry));
 
+    /*
+     * The stored hash values give the new home slots, no key
+     * needs to be hashed again.
+     */
     for (i = 0; i < oldsize; i++) {
-	iter = oldtable[i].next;
-	while (iter) {
-	    next = iter->next;
-
-	    /*
-	     * put back the entry in the new table
-	     */
-
-	    key = xmlHashComputeKey(table, iter->name, iter->name2,
-		                    iter->name3);
-	    if (table->table[key].valid == 0) {
-		memcpy(&(table->table[key]), iter, sizeof(xmlHashEntry));
-		table->table[key].next = NULL;
-		xmlFree(iter);
-	    } else {
-		iter->next = table->table[key].next;
-		table->table[key].next = iter;
-	    }
-
+	if (oldtable[i].hashValue == 0)
+	    continue;
+	xmlHashInsertEntry(newtable, size - 1,
+	                   oldtable[i].hashValue & (size - 1), 0,
+	                   &(oldtable[i]));
 #ifdef DEBUG_GROW
-	    nbElem++;
+	nbElem++;
 #endif
+    }
 
-	    iter = next;
-	}
+    /*
+     * Only publish the new array once it is complete, and before its
+     * size, see xmlHashEntries().
+     */
+    xmlHashWriteBegin(table);
+#ifdef HASH_LOCK_FREE_READS
+    if (table->concurrent) {
+        HASH_STORE_RELEASE(&table->table, newtable);
+        HASH_STORE_RELEASE(&table->size, size);
+    } else
+#endif
+    {
+        table->table = newtable;
+        table->size = size;
     }
+    xmlHashWriteEnd(table);
 
-    xmlFree(oldtable);
+    xmlHashRetire(table, oldtable);
 
 #ifdef DEBUG_GROW
     xmlGenericError(xmlGenericErrorContext,
@@ -318,10 +926,8 @@ xmlHashGrow(xmlHashTablePtr table, int size) {
  */
 void
 xmlHashFree(xmlHashTablePtr table, xmlHashDeallocator f) {
-    int i;
+    unsigned int i;
     xmlHashEntryPtr iter;
-    xmlHashEntryPtr next;
-    int inside_table = 0;
     int nbElems;
 
     if (table == NULL)
@@ -330,36 +936,68 @@ xmlHashFree(xmlHashTablePtr table, xmlHashDeallocator f) {
 	nbElems = table->nbElems;
 	for(i = 0; (i < table->size) && (nbElems > 0); i++) {
 	    iter = &(table->table[i]);
-	    if (iter->valid == 0)
+	    if (iter->hashValue == 0)
 		continue;
-	    inside_table = 1;
-	    while (iter) {
-		next = iter->next;
-		if ((f != NULL) && (iter->payload != NULL))
-		    f(iter->payload, iter->name);
-		if (table->dict == NULL) {
-		    if (iter->name)
-			xmlFree(iter->name);
-		    if (iter->name2)
-			xmlFree(iter->name2);
-		    if (iter->name3)
-			xmlFree(iter->name3);
-		}
-		iter->payload = NULL;
-		if (!inside_table)
-		    xmlFree(iter);
-		nbElems--;
-		inside_table = 0;
-		iter = next;
+	    if ((f != NULL) && (iter->payload != NULL))
+		f(iter->payload, iter->name);
+	    if (table->dict == NULL) {
+		if (iter->name)
+		    xmlFree(iter->name);
+		if (iter->name2)
+		    xmlFree(iter->name2);
+		if (iter->name3)
+		    xmlFree(iter->name3);
 	    }
+	    iter->payload = NULL;
+	    nbElems--;
 	}
 	xmlFree(table->table);
     }
+    if (table->memo)
+        xmlFree(table->memo);
+    if (table->retired) {
+        xmlHashFreeRetired(table);
+        xmlFree(table->retired);
+    }
+    if (table->lock)
+        xmlFreeRMutex(table->lock);
     if (table->dict)
         xmlDictFree(table->dict);
     xmlFree(table);
 }
 
+/**
+ * xmlHashSetConcurrent:
+ * @table: the hash table
+ *
+ * Switch @table to a mode suited to tables shared between threads and
+ * mostly read: lookups then neither lock nor write to the entries, and
+ * may run in any number of threads while one thread adds, updates or
+ * removes entries. Writers are serialized by a lock held by the table.
+ * This must be done before the table is shared, and stays in effect
+ * until the table is freed.
+ *
+ * Entries replaced or removed are still handed to the deallocator right
+ * away, so the caller must make sure no reader still uses such a
+ * payload. Everything else the table drops is kept until a writer finds
+ * no lookup in progress, or until xmlHashFree(), which must not run
+ * concurrently with lookups.
+ *
+ * Returns 0 in case of success, -1 in case of failure
+ */
+int
+xmlHashSetConcurrent(xmlHashTablePtr table) {
+    if (table == NULL)
+        return(-1);
+    if (table->concurrent)
+        return(0);
+    table->lock = xmlNewRMutex();
+    if (table->lock == NULL)
+        return(-1);
+    table->concurrent = 1;
+    return(0);
+}
+
 /**
  * xmlHashAddEntry:
  * @table: the hash table
@@ -499,30 +1137,23 @@ xmlHashQLookup2(xmlHashTablePtr table, const xmlChar *prefix,
     return(xmlHashQLookup3(table, prefix, name, prefix2, name2, NULL, NULL));
 }
 
-/**
- * xmlHashAddEntry3:
- * @table: the hash table
- * @name: the name of the userdata
- * @name2: a second name of the userdata
- * @name3: a third name of the userdata
- * @userdata: a pointer to the userdata
- *
- * Add the @userdata to the hash @table. This can later be retrieved
- * by using the tuple (@name, @name2, @name3). Duplicate entries generate
- * errors.
+/*
+ * xmlHashStoreEntry:
+ * Add the @userdata under the (@name, @name2, @name3) tuple, or if it
+ * exists and @update is set, replace its userdata freeing the old one
+ * with @f if provided.
  *
  * Returns 0 the addition succeeded and -1 in case of error.
  */
-int
-xmlHashAddEntry3(xmlHashTablePtr table, const xmlChar *name,
-	         const xmlChar *name2, const xmlChar *name3,
-		 void *userdata) {
-    unsigned long key, len = 0;
-    xmlHashEntryPtr entry;
+static int
+xmlHashStoreEntry(xmlHashTablePtr table, const xmlChar *name,
+                  const xmlChar *name2, const xmlChar *name3,
+                  void *userdata, int update, xmlHashDeallocator f) {
+    uint32_t hashValue;
+    unsigned int pos, dist;
+    xmlHashEntry entry;
     xmlHashEntryPtr insert;
-
-    if ((table == NULL) || (name == NULL))
-	return(-1);
+    void *old;
 
     /*
      * If using a dict internalize if needed
@@ -548,70 +1179,79 @@ xmlHashAddEntry3(xmlHashTablePtr table, const xmlChar *name,
     /*
      * Check for duplicate and insertion location.
      */
-    key = xmlHashComputeKey(table, name, name2, name3);
-    if (table->table[key].valid == 0) {
-	insert = NULL;
-    } else {
-        if (table->dict) {
-	    for (insert = &(table->table[key]); insert->next != NULL;
-		 insert = insert->next) {
-		if ((insert->name == name) &&
-		    (insert->name2 == name2) &&
-		    (insert->name3 == name3))
-		    return(-1);
-		len++;
-	    }
-	    if ((insert->name == name) &&
-		(insert->name2 == name2) &&
-		(insert->name3 == name3))
-		return(-1);
-	} else {
-	    for (insert = &(table->table[key]); insert->next != NULL;
-		 insert = insert->next) {
-		if ((xmlStrEqual(insert->name, name)) &&
-		    (xmlStrEqual(insert->name2, name2)) &&
-		    (xmlStrEqual(insert->name3, name3)))
-		    return(-1);
-		len++;
-	    }
-	    if ((xmlStrEqual(insert->name, name)) &&
-		(xmlStrEqual(insert->name2, name2)) &&
-		(xmlStrEqual(insert->name3, name3)))
-		return(-1);
-	}
+    hashValue = xmlHashComputeKey(table, name, name2, name3);
+    insert = xmlHashFindEntry(table, hashValue, name, name2, name3,
+                              table->dict != NULL, &pos, &dist);
+    if (insert != NULL) {
+        if (!update)
+            return(-1);
+        xmlHashMemoize(table, name, name2, name3, insert - table->table);
+        old = insert->payload;
+        insert->payload = userdata;
+        if (f)
+            f(old, insert->name);
+        return(0);
     }
 
-    if (insert == NULL) {
-	entry = &(table->table[key]);
-    } else {
-	entry = xmlMalloc(sizeof(xmlHashEntry));
-	if (entry == NULL)
-	     return(-1);
+    /*
+     * Make room first: growing moves the entries around.
+     */
+    if (xmlHashNeedGrow(table)) {
+        if (xmlHashGrow(table, table->size * 2) == 0)
+            xmlHashFindEntry(table, hashValue, name, name2, name3,
+                             table->dict != NULL, &pos, &dist);
+        else if ((unsigned int) table->nbElems + 1 >= table->size)
+            return(-1);
     }
 
     if (table->dict != NULL) {
-        entry->name = (xmlChar *) name;
-        entry->name2 = (xmlChar *) name2;
-        entry->name3 = (xmlChar *) name3;
+        entry.name = (xmlChar *) name;
+        entry.name2 = (xmlChar *) name2;
+        entry.name3 = (xmlChar *) name3;
     } else {
-	entry->name = xmlStrdup(name);
-	entry->name2 = xmlStrdup(name2);
-	entry->name3 = xmlStrdup(name3);
+	entry.name = xmlStrdup(name);
+	entry.name2 = xmlStrdup(name2);
+	entry.name3 = xmlStrdup(name3);
     }
-    entry->payload = userdata;
-    entry->next = NULL;
-    entry->valid = 1;
+    entry.payload = userdata;
+    entry.hashValue = hashValue;
 
+    xmlHashWriteBegin(table);
+    xmlHashInsertEntry(table->table, table->size - 1, pos, dist, &entry);
+    table->nbElems++;
+    xmlHashWriteEnd(table);
+    xmlHashMemoize(table, name, name2, name3, pos);
 
-    if (insert != NULL)
-	insert->next = entry;
+    return(0);
+}
 
-    table->nbElems++;
+/**
+ * xmlHashAddEntry3:
+ * @table: the hash table
+ * @name: the name of the userdata
+ * @name2: a second name of the userdata
+ * @name3: a third name of the userdata
+ * @userdata: a pointer to the userdata
+ *
+ * Add the @userdata to the hash @table. This can later be retrieved
+ * by using the tuple (@name, @name2, @name3). Duplicate entries generate
+ * errors.
+ *
+ * Returns 0 the addition succeeded and -1 in case of error.
+ */
+int
+xmlHashAddEntry3(xmlHashTablePtr table, const xmlChar *name,
+	         const xmlChar *name2, const xmlChar *name3,
+		 void *userdata) {
+    int ret;
 
-    if (len > MAX_HASH_LEN)
-	xmlHashGrow(table, MAX_HASH_LEN * table->size);
+    if ((table == NULL) || (name == NULL))
+	return(-1);
 
-    return(0);
+    xmlHashLock(table);
+    ret = xmlHashStoreEntry(table, name, name2, name3, userdata, 0, NULL);
+    xmlHashUnlock(table);
+    return(ret);
 }
 
 /**
@@ -633,111 +1273,15 @@ int
 xmlHashUpdateEntry3(xmlHashTablePtr table, const xmlChar *name,
 	           const xmlChar *name2, const xmlChar *name3,
 		   void *userdata, xmlHashDeallocator f) {
-    unsigned long key;
-    xmlHashEntryPtr entry;
-    xmlHashEntryPtr insert;
+    int ret;
 
     if ((table == NULL) || name == NULL)
 	return(-1);
 
-    /*
-     * If using a dict internalize if needed
-     */
-    if (table->dict) {
-        if (!xmlDictOwns(table->dict, name)) {
-	    name = xmlDictLookup(table->dict, name, -1);
-	    if (name == NULL)
-	        return(-1);
-	}
-        if ((name2 != NULL) && (!xmlDictOwns(table->dict, name2))) {
-	    name2 = xmlDictLookup(table->dict, name2, -1);
-	    if (name2 == NULL)
-	        return(-1);
-	}
-        if ((name3 != NULL) && (!xmlDictOwns(table->dict, name3))) {
-	    name3 = xmlDictLookup(table->dict, name3, -1);
-	    if (name3 == NULL)
-	        return(-1);
-	}
-    }
-
-    /*
-     * Check for duplicate and insertion location.
-     */
-    key = xmlHashComputeKey(table, name, name2, name3);
-    if (table->table[key].valid == 0) {
-	insert = NULL;
-    } else {
-        if (table ->dict) {
-	    for (insert = &(table->table[key]); insert->next != NULL;
-		 insert = insert->next) {
-		if ((insert->name == name) &&
-		    (insert->name2 == name2) &&
-		    (insert->name3 == name3)) {
-		    if (f)
-			f(insert->payload, insert->name);
-		    insert->payload = userdata;
-		    return(0);
-		}
-	    }
-	    if ((insert->name == name) &&
-		(insert->name2 == name2) &&
-		(insert->name3 == name3)) {
-		if (f)
-		    f(insert->payload, insert->name);
-		insert->payload = userdata;
-		return(0);
-	    }
-	} else {
-	    for (insert = &(table->table[key]); insert->next != NULL;
-		 insert = insert->next) {
-		if ((xmlStrEqual(insert->name, name)) &&
-		    (xmlStrEqual(insert->name2, name2)) &&
-		    (xmlStrEqual(insert->name3, name3))) {
-		    if (f)
-			f(insert->payload, insert->name);
-		    insert->payload = userdata;
-		    return(0);
-		}
-	    }
-	    if ((xmlStrEqual(insert->name, name)) &&
-		(xmlStrEqual(insert->name2, name2)) &&
-		(xmlStrEqual(insert->name3, name3))) {
-		if (f)
-		    f(insert->payload, insert->name);
-		insert->payload = userdata;
-		return(0);
-	    }
-	}
-    }
-
-    if (insert == NULL) {
-	entry =  &(table->table[key]);
-    } else {
-	entry = xmlMalloc(sizeof(xmlHashEntry));
-	if (entry == NULL)
-	     return(-1);
-    }
-
-    if (table->dict != NULL) {
-        entry->name = (xmlChar *) name;
-        entry->name2 = (xmlChar *) name2;
-        entry->name3 = (xmlChar *) name3;
-    } else {
-	entry->name = xmlStrdup(name);
-	entry->name2 = xmlStrdup(name2);
-	entry->name3 = xmlStrdup(name3);
-    }
-    entry->payload = userdata;
-    entry->next = NULL;
-    entry->valid = 1;
-    table->nbElems++;
-
-
-    if (insert != NULL) {
-	insert->next = entry;
-    }
-    return(0);
+    xmlHashLock(table);
+    ret = xmlHashStoreEntry(table, name, name2, name3, userdata, 1, f);
+    xmlHashUnlock(table);
+    return(ret);
 }
 
 /**
@@ -754,31 +1298,68 @@ xmlHashUpdateEntry3(xmlHashTablePtr table, const xmlChar *name,
 void *
 xmlHashLookup3(xmlHashTablePtr table, const xmlChar *name,
 	       const xmlChar *name2, const xmlChar *name3) {
-    unsigned long key;
-    xmlHashEntryPtr entry;
-
     if (table == NULL)
 	return(NULL);
     if (name == NULL)
 	return(NULL);
-    key = xmlHashComputeKey(table, name, name2, name3);
-    if (table->table[key].valid == 0)
+    return(xmlHashLookupPayload(table, name, name2, name3, 0));
+}
+
+/**
+ * xmlHashLookupInterned3:
+ * @table: the hash table
+ * @name: the name of the userdata, from the table dictionary
+ * @name2: a second name of the userdata, from the table dictionary
+ * @name3: a third name of the userdata, from the table dictionary
+ *
+ * Find the userdata specified by the interned (@name, @name2, @name3)
+ * tuple. See xmlHashLookupInterned(). For a table without a dictionary
+ * this is the same as xmlHashLookup3().
+ *
+ * Returns the pointer to the userdata
+ */
+void *
+xmlHashLookupInterned3(xmlHashTablePtr table, const xmlChar *name,
+                       const xmlChar *name2, const xmlChar *name3) {
+    if (table == NULL)
+	return(NULL);
+    if (name == NULL)
 	return(NULL);
-    if (table->dict) {
-	for (entry = &(table->table[key]); entry != NULL; entry = entry->next) {
-	    if ((entry->name == name) &&
-		(entry->name2 == name2) &&
-		(entry->name3 == name3))
-		return(entry->payload);
-	}
-    }
-    for (entry = &(table->table[key]); entry != NULL; entry = entry->next) {
-	if ((xmlStrEqual(entry->name, name)) &&
-	    (xmlStrEqual(entry->name2, name2)) &&
-	    (xmlStrEqual(entry->name3, name3)))
-	    return(entry->payload);
-    }
-    return(NULL);
+    return(xmlHashLookupPayload(table, name, name2, name3,
+                                table->dict != NULL));
+}
+
+/**
+ * xmlHashLookupInterned:
+ * @table: the hash table
+ * @name: the name of the userdata, from the table dictionary
+ *
+ * Find the userdata specified by the interned @name. Names are compared
+ * by pointer only, so they must come from the dictionary the @table
+ * was created with by xmlHashCreateDict().
+ *
+ * Returns the pointer to the userdata
+ */
+void *
+xmlHashLookupInterned(xmlHashTablePtr table, const xmlChar *name) {
+    return(xmlHashLookupInterned3(table, name, NULL, NULL));
+}
+
+/**
+ * xmlHashLookupInterned2:
+ * @table: the hash table
+ * @name: the name of the userdata, from the table dictionary
+ * @name2: a second name of the userdata, from the table dictionary
+ *
+ * Find the userdata specified by the interned (@name, @name2) tuple.
+ * See xmlHashLookupInterned().
+ *
+ * Returns the pointer to the userdata
+ */
+void *
+xmlHashLookupInterned2(xmlHashTablePtr table, const xmlChar *name,
+                       const xmlChar *name2) {
+    return(xmlHashLookupInterned3(table, name, name2, NULL));
 }
 
 /**
@@ -800,24 +1381,23 @@ xmlHashQLookup3(xmlHashTablePtr table,
                 const xmlChar *prefix, const xmlChar *name,
 		const xmlChar *prefix2, const xmlChar *name2,
 		const xmlChar *prefix3, const xmlChar *name3) {
-    unsigned long key;
+    uint32_t hashValue;
     xmlHashEntryPtr entry;
 
     if (table == NULL)
 	return(NULL);
     if (name == NULL)
 	return(NULL);
-    key = xmlHashComputeQKey(table, prefix, name, prefix2,
-                             name2, prefix3, name3);
-    if (table->table[key].valid == 0)
-	return(NULL);
-    for (entry = &(table->table[key]); entry != NULL; entry = entry->next) {
-	if ((xmlStrQEqual(prefix, name, entry->name)) &&
-	    (xmlStrQEqual(prefix2, name2, entry->name2)) &&
-	    (xmlStrQEqual(prefix3, name3, entry->name3)))
-	    return(entry->payload);
-    }
-    return(NULL);
+    hashValue = xmlHashComputeQKey(table, prefix, name, prefix2,
+                                   name2, prefix3, name3);
+    if (table->concurrent)
+        return(xmlHashReadPayload(table, hashValue, 1, prefix, name,
+                                  prefix2, name2, prefix3, name3, 0));
+    entry = xmlHashFindQEntry(table, hashValue, prefix, name,
+                              prefix2, name2, prefix3, name3);
+    if (entry == NULL)
+        return(NULL);
+    return(entry->payload);
 }
 
 typedef struct {
@@ -859,40 +1439,7 @@ xmlHashScan(xmlHashTablePtr table, xmlHashScanner f, void *data) {
  */
 void
 xmlHashScanFull(xmlHashTablePtr table, xmlHashScannerFull f, void *data) {
-    int i, nb;
-    xmlHashEntryPtr iter;
-    xmlHashEntryPtr next;
-
-    if (table == NULL)
-	return;
-    if (f == NULL)
-	return;
-
-    if (table->table) {
-	for(i = 0; i < table->size; i++) {
-	    if (table->table[i].valid == 0)
-		continue;
-	    iter = &(table->table[i]);
-	    while (iter) {
-		next = iter->next;
-                nb = table->nbElems;
-		if ((f != NULL) && (iter->payload != NULL))
-		    f(iter->payload, data, iter->name,
-		      iter->name2, iter->name3);
-                if (nb != table->nbElems) {
-                    /* table was modified by the callback, be careful */
-                    if (iter == &(table->table[i])) {
-                        if (table->table[i].valid == 0)
-                            iter = NULL;
-                        if (table->table[i].next != next)
-			    iter = &(table->table[i]);
-                    } else
-		        iter = next;
-                } else
-		    iter = next;
-	    }
-	}
-    }
+    xmlHashScanFull3(table, NULL, NULL, NULL, f, data);
 }
 
 /**
@@ -933,33 +1480,46 @@ void
 xmlHashScanFull3(xmlHashTablePtr table, const xmlChar *name,
 		 const xmlChar *name2, const xmlChar *name3,
 		 xmlHashScannerFull f, void *data) {
-    int i;
+    unsigned int i, start;
     xmlHashEntryPtr iter;
-    xmlHashEntryPtr next;
+    xmlHashEntry old;
 
     if (table == NULL)
 	return;
     if (f == NULL)
 	return;
 
+    xmlHashLock(table);
     if (table->table) {
+        /*
+         * Start right after an empty slot. If the callback removes an
+         * entry, the following ones are shifted back by one slot, so the
+         * current slot is scanned again; starting at an empty slot makes
+         * sure no entry wraps around past the start.
+         */
+        for (start = 0; start < table->size; start++)
+            if (table->table[start].hashValue == 0)
+                break;
+
 	for(i = 0; i < table->size; i++) {
-	    if (table->table[i].valid == 0)
-		continue;
-	    iter = &(table->table[i]);
-	    while (iter) {
-		next = iter->next;
-		if (((name == NULL) || (xmlStrEqual(name, iter->name))) &&
-		    ((name2 == NULL) || (xmlStrEqual(name2, iter->name2))) &&
-		    ((name3 == NULL) || (xmlStrEqual(name3, iter->name3))) &&
-		    (iter->payload != NULL)) {
-		    f(iter->payload, data, iter->name,
-		      iter->name2, iter->name3);
-		}
-		iter = next;
+	    iter = &(table->table[(start + i) & (table->size - 1)]);
+	    while ((iter->hashValue != 0) && (iter->payload != NULL)) {
+		if (((name != NULL) && (!xmlStrEqual(name, iter->name))) ||
+		    ((name2 != NULL) && (!xmlStrEqual(name2, iter->name2))) ||
+		    ((name3 != NULL) && (!xmlStrEqual(name3, iter->name3))))
+		    break;
+		old = *iter;
+		f(iter->payload, data, iter->name,
+		  iter->name2, iter->name3);
+		/* table was modified by the callback, be careful */
+		if ((iter->name == old.name) &&
+		    (iter->name2 == old.name2) &&
+		    (iter->name3 == old.name3))
+		    break;
 	    }
 	}
     }
+    xmlHashUnlock(table);
 }
 
 /**
@@ -973,9 +1533,8 @@ xmlHashScanFull3(xmlHashTablePtr table, const xmlChar *name,
  */
 xmlHashTablePtr
 xmlHashCopy(xmlHashTablePtr table, xmlHashCopier f) {
-    int i;
+    unsigned int i;
     xmlHashEntryPtr iter;
-    xmlHashEntryPtr next;
     xmlHashTablePtr ret;
 
     if (table == NULL)
@@ -987,20 +1546,17 @@ xmlHashCopy(xmlHashTablePtr table, xmlHashCopier f) {
     if (ret == NULL)
         return(NULL);
 
+    xmlHashLock(table);
     if (table->table) {
 	for(i = 0; i < table->size; i++) {
-	    if (table->table[i].valid == 0)
-		continue;
 	    iter = &(table->table[i]);
-	    while (iter) {
-		next = iter->next;
-		xmlHashAddEntry3(ret, iter->name, iter->name2,
-			         iter->name3, f(iter->payload, iter->name));
-		iter = next;
-	    }
+	    if (iter->hashValue == 0)
+		continue;
+	    xmlHashAddEntry3(ret, iter->name, iter->name2,
+			     iter->name3, f(iter->payload, iter->name));
 	}
     }
-    ret->nbElems = table->nbElems;
+    xmlHashUnlock(table);
     return(ret);
 }
 
@@ -1073,51 +1629,52 @@ xmlHashRemoveEntry2(xmlHashTablePtr table, const xmlChar *name,
 int
 xmlHashRemoveEntry3(xmlHashTablePtr table, const xmlChar *name,
     const xmlChar *name2, const xmlChar *name3, xmlHashDeallocator f) {
-    unsigned long key;
+    unsigned int mask, pos, next;
     xmlHashEntryPtr entry;
-    xmlHashEntryPtr prev = NULL;
+    xmlHashEntry old;
 
     if (table == NULL || name == NULL)
         return(-1);
 
-    key = xmlHashComputeKey(table, name, name2, name3);
-    if (table->table[key].valid == 0) {
-        return(-1);
-    } else {
-        for (entry = &(table->table[key]); entry != NULL; entry = entry->next) {
-            if (xmlStrEqual(entry->name, name) &&
-                    xmlStrEqual(entry->name2, name2) &&
-                    xmlStrEqual(entry->name3, name3)) {
-                if ((f != NULL) && (entry->payload != NULL))
-                    f(entry->payload, entry->name);
-                entry->payload = NULL;
-		if (table->dict == NULL) {
-		    if(entry->name)
-			xmlFree(entry->name);
-		    if(entry->name2)
-			xmlFree(entry->name2);
-		    if(entry->name3)
-			xmlFree(entry->name3);
-		}
-                if(prev) {
-                    prev->next = entry->next;
-		    xmlFree(entry);
-		} else {
-		    if (entry->next == NULL) {
-			entry->valid = 0;
-		    } else {
-			entry = entry->next;
-			memcpy(&(table->table[key]), entry, sizeof(xmlHashEntry));
-			xmlFree(entry);
-		    }
-		}
-                table->nbElems--;
-                return(0);
-            }
-            prev = entry;
-        }
+    xmlHashLock(table);
+    entry = xmlHashFindEntry(table,
+                             xmlHashComputeKey(table, name, name2, name3),
+                             name, name2, name3, 0, NULL, NULL);
+    if (entry == NULL) {
+        xmlHashUnlock(table);
         return(-1);
     }
+    old = *entry;
+
+    /*
+     * Backward shift deletion: move the following entries of the probe
+     * sequence one slot closer to their home slot, no tombstones needed.
+     */
+    xmlHashWriteBegin(table);
+    mask = table->size - 1;
+    pos = entry - table->table;
+    while (1) {
+        next = (pos + 1) & mask;
+        entry = &(table->table[next]);
+        if ((entry->hashValue == 0) ||
+            (((next - entry->hashValue) & mask) == 0))
+            break;
+        table->table[pos] = *entry;
+        pos = next;
+    }
+    memset(&(table->table[pos]), 0, sizeof(xmlHashEntry));
+    table->nbElems--;
+    xmlHashWriteEnd(table);
+
+    if ((f != NULL) && (old.payload != NULL))
+        f(old.payload, old.name);
+    if (table->dict == NULL) {
+        xmlHashRetire(table, old.name);
+        xmlHashRetire(table, old.name2);
+        xmlHashRetire(table, old.name3);
+    }
+    xmlHashUnlock(table);
+    return(0);
 }
 
 #define bottom_hash
@@ -26,43 +26,146 @@
 
 /*
  * Type definition are kept internal
+ *
+ * The elements are stored contiguously in an array, with some free room
+ * kept at both ends so that pushing and popping at either end is cheap.
+ * A link is a slot of that array: it stays valid only until the list is
+ * modified again. The first slots come with the list itself, so short
+ * lists cost a single allocation.
+ *
+ * As long as the list is only built with xmlListInsert() and
+ * xmlListAppend(), or after xmlListSort(), it is known to be sorted and
+ * is searched by bisection. Pushing elements at the ends or reversing it
+ * may break the order, searches then walk the list as they always did.
  */
 
+#define XML_LIST_INLINE_SIZE 8
+
 struct _xmlLink
 {
-    struct _xmlLink *next;
-    struct _xmlLink *prev;
     void *data;
 };
 
 struct _xmlList
 {
-    xmlLinkPtr sentinel;
+    xmlLinkPtr items;           /* the array of elements */
+    int start;                  /* index of the first element */
+    int nbItems;                /* number of elements */
+    int maxItems;               /* size of the array */
+    int sorted;                 /* whether the elements are ordered */
     void (*linkDeallocator)(xmlLinkPtr );
     int (*linkCompare)(const void *, const void*);
+    xmlLink inlineItems[XML_LIST_INLINE_SIZE]; /* the initial array */
 };
 
+/*
+ * Runs shorter than this are sorted by insertion before merging
+ */
+#define XML_LIST_SORT_RUN 8
+
 /************************************************************************
  *                                    *
  *                Interfaces                *
  *                                    *
  ************************************************************************/
 
+/**
+ * xmlListReserve:
+ * @l:  a list
+ * @front:  whether room is needed before the first element
+ *
+ * Make room for one more element at the beginning of the array if @front,
+ * at its end otherwise. The elements are moved around or the array grown
+ * when that side is full, so that a sequence of pushes costs amortized
+ * constant time.
+ *
+ * Returns 0 in case of success, -1 in case of failure
+ */
+static int
+xmlListReserve(xmlListPtr l, int front)
+{
+    xmlLinkPtr tmp;
+    int max, start;
+
+    if (front ? (l->start > 0) : (l->start + l->nbItems < l->maxItems))
+        return(0);
+
+    max = l->maxItems;
+    if (l->nbItems + 1 > max / 2) {
+        max *= 2;
+        if (l->items == l->inlineItems) {
+            tmp = (xmlLinkPtr) xmlMalloc(max * sizeof(xmlLink));
+            if (tmp != NULL)
+                memcpy(tmp, l->items, l->maxItems * sizeof(xmlLink));
+        } else {
+            tmp = (xmlLinkPtr) xmlRealloc(l->items, max * sizeof(xmlLink));
+        }
+        if (tmp == NULL) {
+            xmlGenericError(xmlGenericErrorContext,
+                            "Cannot initialize memory for new link");
+            return(-1);
+        }
+        l->items = tmp;
+        l->maxItems = max;
+    }
+    /* Room at the front is left on both sides, at the back on one */
+    start = front ? (max - l->nbItems) / 2 : 0;
+    memmove(&l->items[start], &l->items[l->start],
+            l->nbItems * sizeof(xmlLink));
+    l->start = start;
+    return(0);
+}
+
+/**
+ * xmlListInsertAt:
+ * @l:  a list
+ * @pos:  the position of the new element, from 0 to the list size
+ * @data:  the data
+ *
+ * Insert @data in the list before the element currently at @pos
+ *
+ * Returns 0 in case of success, -1 in case of failure
+ */
+static int
+xmlListInsertAt(xmlListPtr l, int pos, void *data)
+{
+    if (xmlListReserve(l, pos == 0) < 0)
+        return(-1);
+    if (pos == 0) {
+        l->start--;
+    } else {
+        memmove(&l->items[l->start + pos + 1], &l->items[l->start + pos],
+                (l->nbItems - pos) * sizeof(xmlLink));
+    }
+    l->items[l->start + pos].data = data;
+    l->nbItems++;
+    return(0);
+}
+
 /**
  * xmlLinkDeallocator:
  * @l:  a list
- * @lk:  a link
+ * @pos:  the position of a link
  *
- * Unlink and deallocate @lk from list @l
+ * Deallocate the link at @pos and remove it from list @l
  */
 static void
-xmlLinkDeallocator(xmlListPtr l, xmlLinkPtr lk)
+xmlLinkDeallocator(xmlListPtr l, int pos)
 {
-    (lk->prev)->next = lk->next;
-    (lk->next)->prev = lk->prev;
     if(l->linkDeallocator)
-        l->linkDeallocator(lk);
-    xmlFree(lk);
+        l->linkDeallocator(&l->items[l->start + pos]);
+    /* Close the gap from the shorter side */
+    if (pos < l->nbItems / 2) {
+        memmove(&l->items[l->start + 1], &l->items[l->start],
+                pos * sizeof(xmlLink));
+        l->start++;
+    } else {
+        memmove(&l->items[l->start + pos], &l->items[l->start + pos + 1],
+                (l->nbItems - pos - 1) * sizeof(xmlLink));
+    }
+    l->nbItems--;
+    if (l->nbItems == 0)
+        l->start = 0;
 }
 
 /**
@@ -92,17 +195,31 @@ xmlLinkCompare(const void *data0, const void *data1)
  *
  * Search data in the ordered list walking from the beginning
  *
- * Returns the link containing the data or NULL
+ * Returns the position of the first element not lower than @data, or the
+ *         list size if there is none
  */
-static xmlLinkPtr
+static int
 xmlListLowerSearch(xmlListPtr l, void *data)
 {
-    xmlLinkPtr lk;
+    xmlLinkPtr items = &l->items[l->start];
+    int low, high, mid;
 
-    if (l == NULL)
-        return(NULL);
-    for(lk = l->sentinel->next;lk != l->sentinel && l->linkCompare(lk->data, data) <0 ;lk = lk->next);
-    return lk;
+    if (!l->sorted) {
+        for (low = 0;
+             low < l->nbItems && l->linkCompare(items[low].data, data) < 0;
+             low++);
+        return(low);
+    }
+    low = 0;
+    high = l->nbItems;
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (l->linkCompare(items[mid].data, data) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return(low);
 }
 
 /**
@@ -112,17 +229,31 @@ xmlListLowerSearch(xmlListPtr l, void *data)
  *
  * Search data in the ordered list walking backward from the end
  *
- * Returns the link containing the data or NULL
+ * Returns the position of the last element not greater than @data, or -1
+ *         if there is none
  */
-static xmlLinkPtr
+static int
 xmlListHigherSearch(xmlListPtr l, void *data)
 {
-    xmlLinkPtr lk;
+    xmlLinkPtr items = &l->items[l->start];
+    int low, high, mid;
 
-    if (l == NULL)
-        return(NULL);
-    for(lk = l->sentinel->prev;lk != l->sentinel && l->linkCompare(lk->data, data) >0 ;lk = lk->prev);
-    return lk;
+    if (!l->sorted) {
+        for (high = l->nbItems - 1;
+             high >= 0 && l->linkCompare(items[high].data, data) > 0;
+             high--);
+        return(high);
+    }
+    low = 0;
+    high = l->nbItems;
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (l->linkCompare(items[mid].data, data) > 0)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+    return(low - 1);
 }
 
 /**
@@ -132,22 +263,21 @@ xmlListHigherSearch(xmlListPtr l, void *data)
  *
  * Search data in the list
  *
- * Returns the link containing the data or NULL
+ * Returns the position of the element containing the data or -1
  */
-static xmlLinkPtr
+static int
 xmlListLinkSearch(xmlListPtr l, void *data)
 {
-    xmlLinkPtr lk;
+    int pos;
+
     if (l == NULL)
-        return(NULL);
-    lk = xmlListLowerSearch(l, data);
-    if (lk == l->sentinel)
-        return NULL;
-    else {
-        if (l->linkCompare(lk->data, data) ==0)
-            return lk;
-        return NULL;
-    }
+        return(-1);
+    pos = xmlListLowerSearch(l, data);
+    if (pos == l->nbItems)
+        return(-1);
+    if (l->linkCompare(l->items[l->start + pos].data, data) == 0)
+        return(pos);
+    return(-1);
 }
 
 /**
@@ -157,22 +287,21 @@ xmlListLinkSearch(xmlListPtr l, void *data)
  *
  * Search data in the list processing backward
  *
- * Returns the link containing the data or NULL
+ * Returns the position of the element containing the data or -1
  */
-static xmlLinkPtr
+static int
 xmlListLinkReverseSearch(xmlListPtr l, void *data)
 {
-    xmlLinkPtr lk;
+    int pos;
+
     if (l == NULL)
-        return(NULL);
-    lk = xmlListHigherSearch(l, data);
-    if (lk == l->sentinel)
-        return NULL;
-    else {
-        if (l->linkCompare(lk->data, data) ==0)
-            return lk;
-        return NULL;
-    }
+        return(-1);
+    pos = xmlListHigherSearch(l, data);
+    if (pos < 0)
+        return(-1);
+    if (l->linkCompare(l->items[l->start + pos].data, data) == 0)
+        return(pos);
+    return(-1);
 }
 
 /**
@@ -195,17 +324,9 @@ xmlListCreate(xmlListDeallocator deallocator, xmlListDataCompare compare)
     }
     /* Initialize the list to NULL */
     memset(l, 0, sizeof(xmlList));
-
-    /* Add the sentinel */
-    if (NULL ==(l->sentinel = (xmlLinkPtr )xmlMalloc(sizeof(xmlLink)))) {
-        xmlGenericError(xmlGenericErrorContext,
-		        "Cannot initialize memory for sentinel");
-	xmlFree(l);
-        return (NULL);
-    }
-    l->sentinel->next = l->sentinel;
-    l->sentinel->prev = l->sentinel;
-    l->sentinel->data = NULL;
+    l->items = l->inlineItems;
+    l->maxItems = XML_LIST_INLINE_SIZE;
+    l->sorted = 1;
 
     /* If there is a link deallocator, use it */
     if (deallocator != NULL)
@@ -230,12 +351,12 @@ xmlListCreate(xmlListDeallocator deallocator, xmlListDataCompare compare)
 void *
 xmlListSearch(xmlListPtr l, void *data)
 {
-    xmlLinkPtr lk;
+    int pos;
     if (l == NULL)
         return(NULL);
-    lk = xmlListLinkSearch(l, data);
-    if (lk)
-        return (lk->data);
+    pos = xmlListLinkSearch(l, data);
+    if (pos >= 0)
+        return (l->items[l->start + pos].data);
     return NULL;
 }
 
@@ -251,12 +372,12 @@ xmlListSearch(xmlListPtr l, void *data)
 void *
 xmlListReverseSearch(xmlListPtr l, void *data)
 {
-    xmlLinkPtr lk;
+    int pos;
     if (l == NULL)
         return(NULL);
-    lk = xmlListLinkReverseSearch(l, data);
-    if (lk)
-        return (lk->data);
+    pos = xmlListLinkReverseSearch(l, data);
+    if (pos >= 0)
+        return (l->items[l->start + pos].data);
     return NULL;
 }
 
@@ -272,24 +393,10 @@ xmlListReverseSearch(xmlListPtr l, void *data)
 int
 xmlListInsert(xmlListPtr l, void *data)
 {
-    xmlLinkPtr lkPlace, lkNew;
-
     if (l == NULL)
         return(1);
-    lkPlace = xmlListLowerSearch(l, data);
-    /* Add the new link */
-    lkNew = (xmlLinkPtr) xmlMalloc(sizeof(xmlLink));
-    if (lkNew == NULL) {
-        xmlGenericError(xmlGenericErrorContext,
-		        "Cannot initialize memory for new link");
+    if (xmlListInsertAt(l, xmlListLowerSearch(l, data), data) < 0)
         return (1);
-    }
-    lkNew->data = data;
-    lkPlace = lkPlace->prev;
-    lkNew->next = lkPlace->next;
-    (lkPlace->next)->prev = lkNew;
-    lkPlace->next = lkNew;
-    lkNew->prev = lkPlace;
     return 0;
 }
 
@@ -304,23 +411,10 @@ xmlListInsert(xmlListPtr l, void *data)
  */
 int xmlListAppend(xmlListPtr l, void *data)
 {
-    xmlLinkPtr lkPlace, lkNew;
-
     if (l == NULL)
         return(1);
-    lkPlace = xmlListHigherSearch(l, data);
-    /* Add the new link */
-    lkNew = (xmlLinkPtr) xmlMalloc(sizeof(xmlLink));
-    if (lkNew == NULL) {
-        xmlGenericError(xmlGenericErrorContext,
-		        "Cannot initialize memory for new link");
+    if (xmlListInsertAt(l, xmlListHigherSearch(l, data) + 1, data) < 0)
         return (1);
-    }
-    lkNew->data = data;
-    lkNew->next = lkPlace->next;
-    (lkPlace->next)->prev = lkNew;
-    lkPlace->next = lkNew;
-    lkNew->prev = lkPlace;
     return 0;
 }
 
@@ -336,7 +430,8 @@ void xmlListDelete(xmlListPtr l)
         return;
 
     xmlListClear(l);
-    xmlFree(l->sentinel);
+    if (l->items != l->inlineItems)
+        xmlFree(l->items);
     xmlFree(l);
 }
 
@@ -352,14 +447,14 @@ void xmlListDelete(xmlListPtr l)
 int
 xmlListRemoveFirst(xmlListPtr l, void *data)
 {
-    xmlLinkPtr lk;
+    int pos;
 
     if (l == NULL)
         return(0);
     /*Find the first instance of this data */
-    lk = xmlListLinkSearch(l, data);
-    if (lk != NULL) {
-        xmlLinkDeallocator(l, lk);
+    pos = xmlListLinkSearch(l, data);
+    if (pos >= 0) {
+        xmlLinkDeallocator(l, pos);
         return 1;
     }
     return 0;
@@ -377,14 +472,14 @@ xmlListRemoveFirst(xmlListPtr l, void *data)
 int
 xmlListRemoveLast(xmlListPtr l, void *data)
 {
-    xmlLinkPtr lk;
+    int pos;
 
     if (l == NULL)
         return(0);
     /*Find the last instance of this data */
-    lk = xmlListLinkReverseSearch(l, data);
-    if (lk != NULL) {
-	xmlLinkDeallocator(l, lk);
+    pos = xmlListLinkReverseSearch(l, data);
+    if (pos >= 0) {
+	xmlLinkDeallocator(l, pos);
         return 1;
     }
     return 0;
@@ -416,22 +511,23 @@ xmlListRemoveAll(xmlListPtr l, void *data)
  * xmlListClear:
  * @l:  a list
  *
- * Remove the all data in the list
+ * Remove the all data in the list. The array is kept for reuse.
  */
 void
 xmlListClear(xmlListPtr l)
 {
-    xmlLinkPtr  lk;
+    int i;
 
     if (l == NULL)
         return;
-    lk = l->sentinel->next;
-    while(lk != l->sentinel) {
-        xmlLinkPtr next = lk->next;
-
-        xmlLinkDeallocator(l, lk);
-        lk = next;
+    /* Links need no freeing, only the data */
+    if (l->linkDeallocator) {
+        for (i = 0; i < l->nbItems; i++)
+            l->linkDeallocator(&l->items[l->start + i]);
     }
+    l->start = 0;
+    l->nbItems = 0;
+    l->sorted = 1;
 }
 
 /**
@@ -447,39 +543,41 @@ xmlListEmpty(xmlListPtr l)
 {
     if (l == NULL)
         return(-1);
-    return (l->sentinel->next == l->sentinel);
+    return (l->nbItems == 0);
 }
 
 /**
  * xmlListFront:
  * @l:  a list
  *
- * Get the first element in the list
+ * Get the first element in the list. The link is valid until the list
+ * is modified.
  *
  * Returns the first element in the list, or NULL
  */
 xmlLinkPtr
 xmlListFront(xmlListPtr l)
 {
-    if (l == NULL)
+    if ((l == NULL) || (l->nbItems == 0))
         return(NULL);
-    return (l->sentinel->next);
+    return (&l->items[l->start]);
 }
 
 /**
  * xmlListEnd:
  * @l:  a list
  *
- * Get the last element in the list
+ * Get the last element in the list. The link is valid until the list
+ * is modified.
  *
  * Returns the last element in the list, or NULL
  */
 xmlLinkPtr
 xmlListEnd(xmlListPtr l)
 {
-    if (l == NULL)
+    if ((l == NULL) || (l->nbItems == 0))
         return(NULL);
-    return (l->sentinel->prev);
+    return (&l->items[l->start + l->nbItems - 1]);
 }
 
 /**
@@ -493,14 +591,9 @@ xmlListEnd(xmlListPtr l)
 int
 xmlListSize(xmlListPtr l)
 {
-    xmlLinkPtr lk;
-    int count=0;
-
     if (l == NULL)
         return(-1);
-    /* TODO: keep a counter in xmlList instead */
-    for(lk = l->sentinel->next; lk != l->sentinel; lk = lk->next, count++);
-    return count;
+    return l->nbItems;
 }
 
 /**
@@ -513,7 +606,7 @@ void
 xmlListPopFront(xmlListPtr l)
 {
     if(!xmlListEmpty(l))
-        xmlLinkDeallocator(l, l->sentinel->next);
+        xmlLinkDeallocator(l, 0);
 }
 
 /**
@@ -526,7 +619,7 @@ void
 xmlListPopBack(xmlListPtr l)
 {
     if(!xmlListEmpty(l))
-        xmlLinkDeallocator(l, l->sentinel->prev);
+        xmlLinkDeallocator(l, l->nbItems - 1);
 }
 
 /**
@@ -541,23 +634,12 @@ xmlListPopBack(xmlListPtr l)
 int
 xmlListPushFront(xmlListPtr l, void *data)
 {
-    xmlLinkPtr lkPlace, lkNew;
-
     if (l == NULL)
         return(0);
-    lkPlace = l->sentinel;
-    /* Add the new link */
-    lkNew = (xmlLinkPtr) xmlMalloc(sizeof(xmlLink));
-    if (lkNew == NULL) {
-        xmlGenericError(xmlGenericErrorContext,
-		        "Cannot initialize memory for new link");
+    if (xmlListInsertAt(l, 0, data) < 0)
         return (0);
-    }
-    lkNew->data = data;
-    lkNew->next = lkPlace->next;
-    (lkPlace->next)->prev = lkNew;
-    lkPlace->next = lkNew;
-    lkNew->prev = lkPlace;
+    if (l->nbItems > 1)
+        l->sorted = 0;
     return 1;
 }
 
@@ -573,22 +655,12 @@ xmlListPushFront(xmlListPtr l, void *data)
 int
 xmlListPushBack(xmlListPtr l, void *data)
 {
-    xmlLinkPtr lkPlace, lkNew;
-
     if (l == NULL)
         return(0);
-    lkPlace = l->sentinel->prev;
-    /* Add the new link */
-    if (NULL ==(lkNew = (xmlLinkPtr )xmlMalloc(sizeof(xmlLink)))) {
-        xmlGenericError(xmlGenericErrorContext,
-		        "Cannot initialize memory for new link");
+    if (xmlListInsertAt(l, l->nbItems, data) < 0)
         return (0);
-    }
-    lkNew->data = data;
-    lkNew->next = lkPlace->next;
-    (lkPlace->next)->prev = lkNew;
-    lkPlace->next = lkNew;
-    lkNew->prev = lkPlace;
+    if (l->nbItems > 1)
+        l->sorted = 0;
     return 1;
 }
 
@@ -617,50 +689,112 @@ xmlLinkGetData(xmlLinkPtr lk)
 void
 xmlListReverse(xmlListPtr l)
 {
-    xmlLinkPtr lk;
-    xmlLinkPtr lkPrev;
+    xmlLinkPtr items;
+    xmlLink tmp;
+    int i, j;
 
     if (l == NULL)
         return;
-    lkPrev = l->sentinel;
-    for (lk = l->sentinel->next; lk != l->sentinel; lk = lk->next) {
-        lkPrev->next = lkPrev->prev;
-        lkPrev->prev = lk;
-        lkPrev = lk;
+    items = &l->items[l->start];
+    for (i = 0, j = l->nbItems - 1; i < j; i++, j--) {
+        tmp = items[i];
+        items[i] = items[j];
+        items[j] = tmp;
+    }
+    if (l->nbItems > 1)
+        l->sorted = 0;
+}
+
+/**
+ * xmlListSortRuns:
+ * @l:  a list
+ * @items:  the elements
+ * @n:  the number of elements
+ * @run:  the length of the runs
+ *
+ * Sort every run of @run consecutive elements by insertion
+ */
+static void
+xmlListSortRuns(xmlListPtr l, xmlLinkPtr items, int n, int run)
+{
+    xmlLink cur;
+    int start, end, i, j;
+
+    for (start = 0; start < n; start += run) {
+        end = (n - start < run) ? n : start + run;
+        for (i = start + 1; i < end; i++) {
+            cur = items[i];
+            for (j = i;
+                 j > start && l->linkCompare(items[j - 1].data, cur.data) > 0;
+                 j--)
+                items[j] = items[j - 1];
+            items[j] = cur;
+        }
     }
-    /* Fix up the last node */
-    lkPrev->next = lkPrev->prev;
-    lkPrev->prev = lk;
 }
 
 /**
  * xmlListSort:
  * @l:  a list
  *
- * Sort all the elements in the list
+ * Sort all the elements in the list. Equal elements keep their order.
  */
 void
 xmlListSort(xmlListPtr l)
 {
-    xmlListPtr lTemp;
+    xmlLinkPtr src, dst, tmp, buf;
+    int n, width, low, mid, high, i, j, k;
 
     if (l == NULL)
         return;
     if(xmlListEmpty(l))
         return;
 
-    /* I think that the real answer is to implement quicksort, the
-     * alternative is to implement some list copying procedure which
-     * would be based on a list copy followed by a clear followed by
-     * an insert. This is slow...
+    /*
+     * Bottom-up merge sort: insertion sort short runs, then merge pairs
+     * of runs of doubling width between the array and a scratch buffer.
      */
-
-    if (NULL ==(lTemp = xmlListDup(l)))
+    n = l->nbItems;
+    src = &l->items[l->start];
+    if (n <= XML_LIST_SORT_RUN) {
+        xmlListSortRuns(l, src, n, n);
+        l->sorted = 1;
         return;
-    xmlListClear(l);
-    xmlListMerge(l, lTemp);
-    xmlListDelete(lTemp);
-    return;
+    }
+    buf = (xmlLinkPtr) xmlMalloc(n * sizeof(xmlLink));
+    if (buf == NULL) {
+        xmlListSortRuns(l, src, n, n);
+        l->sorted = 1;
+        return;
+    }
+    xmlListSortRuns(l, src, n, XML_LIST_SORT_RUN);
+    dst = buf;
+    for (width = XML_LIST_SORT_RUN; width < n; width *= 2) {
+        for (low = 0; low < n; low += 2 * width) {
+            mid = (n - low < width) ? n : low + width;
+            high = (n - mid < width) ? n : mid + width;
+            i = low;
+            j = mid;
+            k = low;
+            while ((i < mid) && (j < high)) {
+                if (l->linkCompare(src[j].data, src[i].data) < 0)
+                    dst[k++] = src[j++];
+                else
+                    dst[k++] = src[i++];
+            }
+            while (i < mid)
+                dst[k++] = src[i++];
+            while (j < high)
+                dst[k++] = src[j++];
+        }
+        tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    if (src == buf)
+        memcpy(&l->items[l->start], buf, n * sizeof(xmlLink));
+    xmlFree(buf);
+    l->sorted = 1;
 }
 
 /**
@@ -674,12 +808,12 @@ xmlListSort(xmlListPtr l)
  */
 void
 xmlListWalk(xmlListPtr l, xmlListWalker walker, const void *user) {
-    xmlLinkPtr lk;
+    int i;
 
     if ((l == NULL) || (walker == NULL))
         return;
-    for(lk = l->sentinel->next; lk != l->sentinel; lk = lk->next) {
-        if((walker(lk->data, user)) == 0)
+    for(i = 0; i < l->nbItems; i++) {
+        if((walker(l->items[l->start + i].data, user)) == 0)
                 break;
     }
 }
@@ -695,12 +829,12 @@ xmlListWalk(xmlListPtr l, xmlListWalker walker, const void *user) {
  */
 void
 xmlListReverseWalk(xmlListPtr l, xmlListWalker walker, const void *user) {
-    xmlLinkPtr lk;
+    int i;
 
     if ((l == NULL) || (walker == NULL))
         return;
-    for(lk = l->sentinel->prev; lk != l->sentinel; lk = lk->prev) {
-        if((walker(lk->data, user)) == 0)
+    for(i = l->nbItems - 1; i >= 0; i--) {
+        if((walker(l->items[l->start + i].data, user)) == 0)
                 break;
     }
 }
@@ -761,12 +895,12 @@ int
 xmlListCopy(xmlListPtr cur, const xmlListPtr old)
 {
     /* Walk the old tree and insert the data into the new one */
-    xmlLinkPtr lk;
+    int i;
 
     if ((old == NULL) || (cur == NULL))
         return(1);
-    for(lk = old->sentinel->next; lk != old->sentinel; lk = lk->next) {
-        if (0 !=xmlListInsert(cur, lk->data)) {
+    for(i = 0; i < old->nbItems; i++) {
+        if (0 !=xmlListInsert(cur, old->items[old->start + i].data)) {
             xmlListDelete(cur);
             return (1);
         }
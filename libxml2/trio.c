@@ -280,6 +280,23 @@ typedef trio_longlong_t trio_int64_t;
 
 #define TRIO_FABS(x) (((x) < 0.0) ? -(x) : (x))
 
+/*
+ * Shortest representation of doubles needs 64-bit integers and the
+ * IEEE 754 double format
+ */
+#if (defined(USE_LONGLONG) || defined(TRIO_COMPILER_SUPPORTS_MSVC_INT)) \
+ && (FLT_RADIX == 2) && (DBL_MANT_DIG == 53) && (DBL_MAX_EXP == 1024)
+# define TRIO_SHORTEST_DOUBLE
+#endif
+
+/*
+ * The printf family caches parsed formatting strings where the compiler
+ * provides the atomic builtins needed to lock the cache
+ */
+#if TRIO_EXTENSION && defined(__ATOMIC_ACQUIRE)
+# define TRIO_FORMAT_CACHE
+#endif
+
 /*************************************************************************
  * Internal Definitions
  */
@@ -390,6 +407,8 @@ enum {
 
   /* Maximal number of allowed parameters */
   MAX_PARAMETERS = 64,
+  /* Number of formatting strings remembered by the printf family */
+  FORMAT_CACHE_SIZE = 16,
   /* Maximal number of characters in class */
   MAX_CHARACTER_CLASS = UCHAR_MAX + 1,
 
@@ -403,7 +422,12 @@ enum {
   MAX_LOCALE_GROUPS = 64,
 
   /* Initial size of asprintf buffer */
-  DYNAMIC_START_SIZE = 32
+  DYNAMIC_START_SIZE = 32,
+
+  /* Size of the output buffer of file streams */
+  OUTPUT_BUFFER_SIZE = 512,
+  /* Size of the chunks in which padding is written */
+  PADDING_CHUNK_SIZE = 32
 };
 
 #define NO_GROUPING ((int)CHAR_MAX)
@@ -701,6 +725,16 @@ typedef struct _trio_class_t {
    * The function to write characters to a stream.
    */
   void (*OutStream) TRIO_PROTO((struct _trio_class_t *, int));
+  /*
+   * The function to write a span of characters to a stream, or NULL
+   * if they must be written one at a time.
+   */
+  void (*OutSpan) TRIO_PROTO((struct _trio_class_t *, TRIO_CONST char *, int));
+  /*
+   * The function to write out buffered characters, or NULL if the
+   * stream is not buffered.
+   */
+  void (*OutFlush) TRIO_PROTO((struct _trio_class_t *));
   /*
    * The function to read characters from a stream.
    */
@@ -734,6 +768,21 @@ typedef struct _trio_class_t {
   int error;
 } trio_class_t;
 
+/* Output streams */
+typedef struct {
+  void (*OutStream) TRIO_PROTO((trio_class_t *, int));
+  void (*OutSpan) TRIO_PROTO((trio_class_t *, TRIO_CONST char *, int));
+  void (*OutFlush) TRIO_PROTO((trio_class_t *));
+} trio_output_t;
+
+/* Output buffer, the location of buffered streams */
+typedef struct {
+  /* The location of the underlying stream */
+  trio_pointer_t target;
+  int length;
+  char data[OUTPUT_BUFFER_SIZE];
+} trio_buffer_t;
+
 /* References (for user-defined callbacks) */
 typedef struct _trio_reference_t {
   trio_class_t *data;
@@ -747,6 +796,20 @@ typedef struct _trio_userdef_t {
   char *name;
 } trio_userdef_t;
 
+/* Formatting strings parsed once for repeated use */
+typedef struct _trio_compiled_t {
+  /* Private copy of the formatting string */
+  char *format;
+  /* The number of arguments */
+  int arguments;
+  /* The entry of each argument */
+  int indices[MAX_PARAMETERS];
+  /* The number of entries */
+  int count;
+  /* The entries, without argument data */
+  trio_parameter_t parameters[1];
+} trio_compiled_t;
+
 /*************************************************************************
  *
  * Internal Variables
@@ -783,6 +846,17 @@ static char internalGrouping[MAX_LOCALE_GROUPS] = { (char)NO_GROUPING };
 
 static TRIO_CONST char internalDigitsLower[] = "0123456789abcdefghijklmnopqrstuvwxyz";
 static TRIO_CONST char internalDigitsUpper[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+static TRIO_CONST char internalDigitPairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
 static BOOLEAN_T internalDigitsUnconverted = TRUE;
 static int internalDigitArray[128];
 #if TRIO_EXTENSION
@@ -795,6 +869,14 @@ static TRIO_VOLATILE trio_callback_t internalEnterCriticalRegion = NULL;
 static TRIO_VOLATILE trio_callback_t internalLeaveCriticalRegion = NULL;
 static trio_userdef_t *internalUserDef = NULL;
 #endif
+#if defined(TRIO_FORMAT_CACHE)
+/* Formatting strings recently used by the printf family, by address */
+static struct {
+  TRIO_CONST char *format;
+  trio_compiled_t *compiled;
+} internalFormatCache[FORMAT_CACHE_SIZE];
+static int internalFormatCacheLock = 0;
+#endif
 
 
 /*************************************************************************
@@ -1171,20 +1253,440 @@ TRIO_ARGS1((base),
     }
 }
 
+#if defined(TRIO_SHORTEST_DOUBLE)
 /*************************************************************************
- * TrioParse
+ * Shortest representation of doubles
+ *
+ * The Grisu2 algorithm finds a short decimal representation of a
+ * double that reads back to the same double, using 64-bit integer
+ * arithmetic only. It is the shortest one in the vast majority of
+ * cases, and never more than one ulp away from the double.
+ *
+ * Reference: Loitsch, "Printing Floating-Point Numbers Quickly and
+ *            Accurately with Integers", PLDI 2010
+ */
+
+#define TRIO_U64(high, low) \
+  (((trio_ulonglong_t)(high) << 32) | (trio_ulonglong_t)(low))
+
+typedef struct {
+  trio_ulonglong_t f;
+  int e;
+} trio_diyfp_t;
+
+typedef struct {
+  unsigned long high;
+  unsigned long low;
+  int exponent;
+} trio_cached_power_t;
+
+/* Normalized 10^k for k = -348, -340, ..., 340 */
+static TRIO_CONST trio_cached_power_t internalCachedPowers[] = {
+  { 0xfa8fd5a0UL, 0x081c0288UL, -1220 },
+  { 0xbaaee17fUL, 0xa23ebf76UL, -1193 },
+  { 0x8b16fb20UL, 0x3055ac76UL, -1166 },
+  { 0xcf42894aUL, 0x5dce35eaUL, -1140 },
+  { 0x9a6bb0aaUL, 0x55653b2dUL, -1113 },
+  { 0xe61acf03UL, 0x3d1a45dfUL, -1087 },
+  { 0xab70fe17UL, 0xc79ac6caUL, -1060 },
+  { 0xff77b1fcUL, 0xbebcdc4fUL, -1034 },
+  { 0xbe5691efUL, 0x416bd60cUL, -1007 },
+  { 0x8dd01fadUL, 0x907ffc3cUL, -980 },
+  { 0xd3515c28UL, 0x31559a83UL, -954 },
+  { 0x9d71ac8fUL, 0xada6c9b5UL, -927 },
+  { 0xea9c2277UL, 0x23ee8bcbUL, -901 },
+  { 0xaecc4991UL, 0x4078536dUL, -874 },
+  { 0x823c1279UL, 0x5db6ce57UL, -847 },
+  { 0xc2109436UL, 0x4dfb5637UL, -821 },
+  { 0x9096ea6fUL, 0x3848984fUL, -794 },
+  { 0xd77485cbUL, 0x25823ac7UL, -768 },
+  { 0xa086cfcdUL, 0x97bf97f4UL, -741 },
+  { 0xef340a98UL, 0x172aace5UL, -715 },
+  { 0xb23867fbUL, 0x2a35b28eUL, -688 },
+  { 0x84c8d4dfUL, 0xd2c63f3bUL, -661 },
+  { 0xc5dd4427UL, 0x1ad3cdbaUL, -635 },
+  { 0x936b9fceUL, 0xbb25c996UL, -608 },
+  { 0xdbac6c24UL, 0x7d62a584UL, -582 },
+  { 0xa3ab6658UL, 0x0d5fdaf6UL, -555 },
+  { 0xf3e2f893UL, 0xdec3f126UL, -529 },
+  { 0xb5b5ada8UL, 0xaaff80b8UL, -502 },
+  { 0x87625f05UL, 0x6c7c4a8bUL, -475 },
+  { 0xc9bcff60UL, 0x34c13053UL, -449 },
+  { 0x964e858cUL, 0x91ba2655UL, -422 },
+  { 0xdff97724UL, 0x70297ebdUL, -396 },
+  { 0xa6dfbd9fUL, 0xb8e5b88fUL, -369 },
+  { 0xf8a95fcfUL, 0x88747d94UL, -343 },
+  { 0xb9447093UL, 0x8fa89bcfUL, -316 },
+  { 0x8a08f0f8UL, 0xbf0f156bUL, -289 },
+  { 0xcdb02555UL, 0x653131b6UL, -263 },
+  { 0x993fe2c6UL, 0xd07b7facUL, -236 },
+  { 0xe45c10c4UL, 0x2a2b3b06UL, -210 },
+  { 0xaa242499UL, 0x697392d3UL, -183 },
+  { 0xfd87b5f2UL, 0x8300ca0eUL, -157 },
+  { 0xbce50864UL, 0x92111aebUL, -130 },
+  { 0x8cbccc09UL, 0x6f5088ccUL, -103 },
+  { 0xd1b71758UL, 0xe219652cUL, -77 },
+  { 0x9c400000UL, 0x00000000UL, -50 },
+  { 0xe8d4a510UL, 0x00000000UL, -24 },
+  { 0xad78ebc5UL, 0xac620000UL, 3 },
+  { 0x813f3978UL, 0xf8940984UL, 30 },
+  { 0xc097ce7bUL, 0xc90715b3UL, 56 },
+  { 0x8f7e32ceUL, 0x7bea5c70UL, 83 },
+  { 0xd5d238a4UL, 0xabe98068UL, 109 },
+  { 0x9f4f2726UL, 0x179a2245UL, 136 },
+  { 0xed63a231UL, 0xd4c4fb27UL, 162 },
+  { 0xb0de6538UL, 0x8cc8ada8UL, 189 },
+  { 0x83c7088eUL, 0x1aab65dbUL, 216 },
+  { 0xc45d1df9UL, 0x42711d9aUL, 242 },
+  { 0x924d692cUL, 0xa61be758UL, 269 },
+  { 0xda01ee64UL, 0x1a708deaUL, 295 },
+  { 0xa26da399UL, 0x9aef774aUL, 322 },
+  { 0xf209787bUL, 0xb47d6b85UL, 348 },
+  { 0xb454e4a1UL, 0x79dd1877UL, 375 },
+  { 0x865b8692UL, 0x5b9bc5c2UL, 402 },
+  { 0xc83553c5UL, 0xc8965d3dUL, 428 },
+  { 0x952ab45cUL, 0xfa97a0b3UL, 455 },
+  { 0xde469fbdUL, 0x99a05fe3UL, 481 },
+  { 0xa59bc234UL, 0xdb398c25UL, 508 },
+  { 0xf6c69a72UL, 0xa3989f5cUL, 534 },
+  { 0xb7dcbf53UL, 0x54e9beceUL, 561 },
+  { 0x88fcf317UL, 0xf22241e2UL, 588 },
+  { 0xcc20ce9bUL, 0xd35c78a5UL, 614 },
+  { 0x98165af3UL, 0x7b2153dfUL, 641 },
+  { 0xe2a0b5dcUL, 0x971f303aUL, 667 },
+  { 0xa8d9d153UL, 0x5ce3b396UL, 694 },
+  { 0xfb9b7cd9UL, 0xa4a7443cUL, 720 },
+  { 0xbb764c4cUL, 0xa7a44410UL, 747 },
+  { 0x8bab8eefUL, 0xb6409c1aUL, 774 },
+  { 0xd01fef10UL, 0xa657842cUL, 800 },
+  { 0x9b10a4e5UL, 0xe9913129UL, 827 },
+  { 0xe7109bfbUL, 0xa19c0c9dUL, 853 },
+  { 0xac2820d9UL, 0x623bf429UL, 880 },
+  { 0x80444b5eUL, 0x7aa7cf85UL, 907 },
+  { 0xbf21e440UL, 0x03acdd2dUL, 933 },
+  { 0x8e679c2fUL, 0x5e44ff8fUL, 960 },
+  { 0xd433179dUL, 0x9c8cb841UL, 986 },
+  { 0x9e19db92UL, 0xb4e31ba9UL, 1013 },
+  { 0xeb96bf6eUL, 0xbadf77d9UL, 1039 },
+  { 0xaf87023bUL, 0x9bf0ee6bUL, 1066 }
+};
+
+static TRIO_CONST unsigned int internalPowersOfTen[] = {
+  1UL, 10UL, 100UL, 1000UL, 10000UL, 100000UL, 1000000UL, 10000000UL,
+  100000000UL, 1000000000UL
+};
+
+/*************************************************************************
+ * TrioDiyMultiply
+ *
+ * Description:
+ *  Multiply two 64-bit floating-point numbers, rounding the result.
+ */
+TRIO_PRIVATE trio_diyfp_t
+TrioDiyMultiply
+TRIO_ARGS2((x, y),
+	   trio_diyfp_t x,
+	   trio_diyfp_t y)
+{
+  trio_ulonglong_t mask = TRIO_U64(0, 0xFFFFFFFFUL);
+  trio_ulonglong_t a = x.f >> 32;
+  trio_ulonglong_t b = x.f & mask;
+  trio_ulonglong_t c = y.f >> 32;
+  trio_ulonglong_t d = y.f & mask;
+  trio_ulonglong_t ac = a * c;
+  trio_ulonglong_t bc = b * c;
+  trio_ulonglong_t ad = a * d;
+  trio_ulonglong_t bd = b * d;
+  trio_ulonglong_t tmp;
+  trio_diyfp_t result;
+
+  tmp = (bd >> 32) + (ad & mask) + (bc & mask);
+  tmp += TRIO_U64(0, 0x80000000UL); /* Round */
+  result.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+  result.e = x.e + y.e + 64;
+  return result;
+}
+
+/*************************************************************************
+ * TrioDiyNormalize
+ */
+TRIO_PRIVATE trio_diyfp_t
+TrioDiyNormalize
+TRIO_ARGS1((x),
+	   trio_diyfp_t x)
+{
+  while (!(x.f & TRIO_U64(0xFFC00000UL, 0)))
+    {
+      x.f <<= 10;
+      x.e -= 10;
+    }
+  while (!(x.f & TRIO_U64(0x80000000UL, 0)))
+    {
+      x.f <<= 1;
+      x.e--;
+    }
+  return x;
+}
+
+/*************************************************************************
+ * TrioGrisuRound
+ *
+ * Description:
+ *  Move the last digit down towards the double, while the digits stay
+ *  within its rounding interval.
+ */
+TRIO_PRIVATE void
+TrioGrisuRound
+TRIO_ARGS6((buffer, length, delta, rest, tenKappa, distance),
+	   char *buffer,
+	   int length,
+	   trio_ulonglong_t delta,
+	   trio_ulonglong_t rest,
+	   trio_ulonglong_t tenKappa,
+	   trio_ulonglong_t distance)
+{
+  while ((rest < distance) && (delta - rest >= tenKappa) &&
+	 ((rest + tenKappa < distance) ||
+	  (distance - rest > rest + tenKappa - distance)))
+    {
+      buffer[length - 1]--;
+      rest += tenKappa;
+    }
+}
+
+/*************************************************************************
+ * TrioGrisuDigits
  *
  * Description:
- *  Parse the format string
+ *  Generate the digits of the upper boundary @high until they are
+ *  within @delta of it, then round them towards the number @distance
+ *  below it. The decimal exponent is adjusted in @exponent. Gives up
+ *  with zero digits when more than @limit digits are needed.
  */
 TRIO_PRIVATE int
-TrioParse
-TRIO_ARGS5((type, format, parameters, arglist, argarray),
+TrioGrisuDigits
+TRIO_ARGS6((high, distance, delta, limit, buffer, exponent),
+	   trio_diyfp_t high,
+	   trio_ulonglong_t distance,
+	   trio_ulonglong_t delta,
+	   int limit,
+	   char *buffer,
+	   int *exponent)
+{
+  trio_ulonglong_t one = (trio_ulonglong_t)1 << -high.e;
+  trio_ulonglong_t fraction = high.f & (one - 1);
+  trio_ulonglong_t rest;
+  trio_ulonglong_t unit = 1;
+  unsigned int integer = (unsigned int)(high.f >> -high.e);
+  unsigned int digit;
+  int kappa;
+  int length = 0;
+
+  for (kappa = 1;
+       (kappa < 10) && (integer >= internalPowersOfTen[kappa]);
+       kappa++)
+    continue;
+
+  /* Integer part */
+  while (kappa > 0)
+    {
+      digit = integer / internalPowersOfTen[kappa - 1];
+      integer %= internalPowersOfTen[kappa - 1];
+      if ((digit != 0) || (length > 0))
+	buffer[length++] = (char)('0' + digit);
+      if (length > limit)
+	return 0;
+      kappa--;
+      rest = ((trio_ulonglong_t)integer << -high.e) + fraction;
+      if (rest <= delta)
+	{
+	  *exponent += kappa;
+	  TrioGrisuRound(buffer, length, delta, rest,
+			 (trio_ulonglong_t)internalPowersOfTen[kappa] << -high.e,
+			 distance);
+	  return length;
+	}
+    }
+
+  /* Fractional part */
+  for (;;)
+    {
+      fraction *= 10;
+      delta *= 10;
+      unit *= 10;
+      digit = (unsigned long)(fraction >> -high.e);
+      if ((digit != 0) || (length > 0))
+	buffer[length++] = (char)('0' + digit);
+      if (length > limit)
+	return 0;
+      fraction &= one - 1;
+      kappa--;
+      if (fraction < delta)
+	{
+	  *exponent += kappa;
+	  TrioGrisuRound(buffer, length, delta, fraction, one,
+			 (-kappa < 20) ? distance * unit : 0);
+	  return length;
+	}
+    }
+}
+
+/*************************************************************************
+ * TrioShortestDigits
+ *
+ * Description:
+ *  Store in @buffer the digits of the shortest representation of the
+ *  non-negative finite @number, without trailing zeroes. The decimal
+ *  exponent of the first digit is returned in @exponent.
+ *
+ * Returns:
+ *  The number of digits, or zero if more than @limit digits (at most
+ *  DBL_DIG), or digits below 10^@lowest, are needed.
+ */
+TRIO_PRIVATE int
+TrioShortestDigits
+TRIO_ARGS5((number, limit, lowest, buffer, exponent),
+	   double number,
+	   int limit,
+	   int lowest,
+	   char *buffer,
+	   int *exponent)
+{
+  union {
+    double number;
+    trio_ulonglong_t bits;
+  } value;
+  trio_diyfp_t v;
+  trio_diyfp_t high;
+  trio_diyfp_t low;
+  trio_diyfp_t cached;
+  double estimate;
+  int biased;
+  int k;
+  int index;
+  int first;
+  int length;
+
+  if (number == 0.0)
+    {
+      buffer[0] = '0';
+      *exponent = 0;
+      return 1;
+    }
+
+  value.number = number;
+  biased = (int)((value.bits >> 52) & 0x7FF);
+  v.f = value.bits & TRIO_U64(0x000FFFFFUL, 0xFFFFFFFFUL);
+  if (biased != 0)
+    {
+      v.f += TRIO_U64(0x00100000UL, 0);
+      v.e = biased - 1075;
+    }
+  else
+    {
+      v.e = -1074;
+    }
+
+  /* Boundaries halfway to the neighbouring doubles */
+  high.f = (v.f << 1) + 1;
+  high.e = v.e - 1;
+  high = TrioDiyNormalize(high);
+  if (v.f == TRIO_U64(0x00100000UL, 0))
+    {
+      low.f = (v.f << 2) - 1;
+      low.e = v.e - 2;
+    }
+  else
+    {
+      low.f = (v.f << 1) - 1;
+      low.e = v.e - 1;
+    }
+  low.f <<= low.e - high.e;
+  low.e = high.e;
+
+  /* Scale by a cached 10^-k to bring the binary exponent to [-60, -32] */
+  estimate = (-61 - high.e) * 0.30102999566398114 + 347;
+  k = (int)estimate;
+  if (estimate - k > 0.0)
+    k++;
+  index = (k >> 3) + 1;
+  k = -(-348 + index * 8);
+  cached.f = TRIO_U64(internalCachedPowers[index].high,
+		      internalCachedPowers[index].low);
+  cached.e = internalCachedPowers[index].exponent;
+
+  v = TrioDiyMultiply(TrioDiyNormalize(v), cached);
+  high = TrioDiyMultiply(high, cached);
+  low = TrioDiyMultiply(low, cached);
+  low.f++;
+  high.f--;
+  /* The first digit comes from the integer part of the scaled boundary */
+  first = k;
+  for (index = 1;
+       (index < 10) && ((high.f >> -high.e) >= internalPowersOfTen[index]);
+       index++)
+    first++;
+  if (lowest > first - limit + 1)
+    limit = first - lowest + 1;
+  if (limit > DBL_DIG)
+    limit = DBL_DIG;
+  if (limit <= 0)
+    return 0;
+
+  length = TrioGrisuDigits(high, high.f - v.f, high.f - low.f, limit,
+			   buffer, &k);
+  if (length == 0)
+    return 0;
+
+  while ((length > 1) && (buffer[length - 1] == '0'))
+    {
+      length--;
+      k++;
+    }
+  *exponent = k + length - 1;
+  return length;
+}
+
+/*************************************************************************
+ * TrioShortestDigit
+ *
+ * Description:
+ *  Get the digit for 10^@position of a number from its shortest
+ *  representation.
+ */
+TRIO_PRIVATE int
+TrioShortestDigit
+TRIO_ARGS4((digits, length, exponent, position),
+	   TRIO_CONST char *digits,
+	   int length,
+	   int exponent,
+	   int position)
+{
+  int index = exponent - position;
+
+  return ((index >= 0) && (index < length)) ? digits[index] - '0' : 0;
+}
+#endif /* TRIO_SHORTEST_DOUBLE */
+
+/*************************************************************************
+ * TrioParseSpecifiers
+ *
+ * Description:
+ *  Parse the format string into @parameters, without touching the
+ *  arguments. The number of entries is returned in @count, and the
+ *  entry of each argument in @indices.
+ *
+ * Returns:
+ *  The number of arguments, or an error code.
+ */
+TRIO_PRIVATE int
+TrioParseSpecifiers
+TRIO_ARGS5((type, format, parameters, indices, count),
 	   int type,
 	   TRIO_CONST char *format,
 	   trio_parameter_t *parameters,
-	   TRIO_VA_LIST_PTR arglist,
-	   trio_pointer_t *argarray)
+	   int *indices,
+	   int *count)
 {
   /* Count the number of times a parameter is referenced */
   unsigned short usedEntries[MAX_PARAMETERS];
@@ -1202,32 +1704,22 @@ TRIO_ARGS5((type, format, parameters, arglist, argarray),
   int dots;  /* Count number of dots in modifier part */
   BOOLEAN_T positional;  /* Does the specifier have a positional? */
   BOOLEAN_T gotSticky = FALSE;  /* Are there any sticky modifiers at all? */
-  /*
-   * indices specifies the order in which the parameters must be
-   * read from the va_args (this is necessary to handle positionals)
-   */
-  int indices[MAX_PARAMETERS];
   int pos = 0;
   /* Various variables */
   char ch;
 #if defined(TRIO_COMPILER_SUPPORTS_MULTIBYTE)
   int charlen;
 #endif
-  int save_errno;
   int i = -1;
   int num;
   char *tmpformat;
 
-  /* One and only one of arglist and argarray must be used */
-  assert((arglist != NULL) ^ (argarray != NULL));
-
   /*
    * The 'parameters' array is not initialized, but we need to
    * know which entries we have used.
    */
   memset(usedEntries, 0, sizeof(usedEntries));
 
-  save_errno = errno;
   index = 0;
   parameterPosition = 0;
 #if defined(TRIO_COMPILER_SUPPORTS_MULTIBYTE)
@@ -1921,7 +2413,41 @@ TRIO_ARGS5((type, format, parameters, arglist, argarray),
 	  else /* double references detected */
 	    return TRIO_ERROR_RETURN(TRIO_EDBLREF, num);
 	}
+    }
+
+  *count = pos;
+  return maxParam + 1;
+}
+
+/*************************************************************************
+ * TrioReadArguments
+ *
+ * Description:
+ *  Read the @arguments arguments of parsed @parameters, in the order
+ *  given by @indices.
+ */
+TRIO_PRIVATE int
+TrioReadArguments
+TRIO_ARGS6((type, parameters, indices, arguments, arglist, argarray),
+	   int type,
+	   trio_parameter_t *parameters,
+	   TRIO_CONST int *indices,
+	   int arguments,
+	   TRIO_VA_LIST_PTR arglist,
+	   trio_pointer_t *argarray)
+{
+  int save_errno;
+  int varsize;
+  int i;
+  int num;
+
+  /* One and only one of arglist and argarray must be used */
+  assert((arglist != NULL) ^ (argarray != NULL));
+
+  save_errno = errno;
 
+  for (num = 0; num < arguments; num++)
+    {
       i = indices[num];
 
       /*
@@ -1958,7 +2484,7 @@ TRIO_ARGS5((type, format, parameters, arglist, argarray),
 	case FORMAT_GROUP:
 	case FORMAT_STRING:
 #if TRIO_WIDECHAR
-	  if (flags & FLAGS_WIDECHAR)
+	  if (parameters[i].flags & FLAGS_WIDECHAR)
 	    {
 	      parameters[i].data.wstring = (argarray == NULL)
 		? va_arg(TRIO_VA_LIST_DEREF(arglist), trio_wchar_t *)
@@ -2162,67 +2688,335 @@ TRIO_ARGS5((type, format, parameters, arglist, argarray),
   return num;
 }
 
-
 /*************************************************************************
+ * TrioParse
  *
- * FORMATTING
- *
- ************************************************************************/
+ * Description:
+ *  Parse the format string and read the arguments
+ */
+TRIO_PRIVATE int
+TrioParse
+TRIO_ARGS5((type, format, parameters, arglist, argarray),
+	   int type,
+	   TRIO_CONST char *format,
+	   trio_parameter_t *parameters,
+	   TRIO_VA_LIST_PTR arglist,
+	   trio_pointer_t *argarray)
+{
+  /*
+   * indices specifies the order in which the parameters must be
+   * read from the va_args (this is necessary to handle positionals)
+   */
+  int indices[MAX_PARAMETERS];
+  int count;
+  int status;
+
+  status = TrioParseSpecifiers(type, format, parameters, indices, &count);
+  if (status < 0)
+    return status;
 
+  return TrioReadArguments(type, parameters, indices, status,
+			   arglist, argarray);
+}
 
 /*************************************************************************
- * TrioWriteNumber
+ * TrioCompile
  *
  * Description:
- *  Output a number.
- *  The complexity of this function is a result of the complexity
- *  of the dependencies of the flags.
+ *  Keep the result of TrioParseSpecifiers for the formatting string
+ *  @format, without the argument data.
  */
-TRIO_PRIVATE void
-TrioWriteNumber
-TRIO_ARGS6((self, number, flags, width, precision, base),
-	   trio_class_t *self,
-	   trio_uintmax_t number,
-	   trio_flags_t flags,
-	   int width,
-	   int precision,
-	   int base)
+TRIO_PRIVATE trio_compiled_t *
+TrioCompile
+TRIO_ARGS5((format, parameters, indices, arguments, count),
+	   TRIO_CONST char *format,
+	   TRIO_CONST trio_parameter_t *parameters,
+	   TRIO_CONST int *indices,
+	   int arguments,
+	   int count)
 {
-  BOOLEAN_T isNegative;
-  BOOLEAN_T isNumberZero;
-  BOOLEAN_T isPrecisionZero;
-  BOOLEAN_T ignoreNumber;
-  char buffer[MAX_CHARS_IN(trio_uintmax_t) * (1 + MAX_LOCALE_SEPARATOR_LENGTH) + 1];
-  char *bufferend;
-  char *pointer;
-  TRIO_CONST char *digits;
+  trio_compiled_t *compiled;
   int i;
-  int length;
-  char *p;
-  int count;
 
-  assert(VALID(self));
-  assert(VALID(self->OutStream));
-  assert(((base >= MIN_BASE) && (base <= MAX_BASE)) || (base == NO_BASE));
+  compiled = (trio_compiled_t *)TRIO_MALLOC(sizeof(trio_compiled_t)
+					    + ((count > 1) ? count - 1 : 0)
+					    * sizeof(trio_parameter_t));
+  if (compiled)
+    {
+      compiled->format = trio_duplicate(format);
+      if (compiled->format == NULL)
+	{
+	  TRIO_FREE(compiled);
+	  return NULL;
+	}
+      compiled->arguments = arguments;
+      for (i = 0; i < arguments; i++)
+	compiled->indices[i] = indices[i];
+      compiled->count = count;
+      for (i = 0; i < count; i++)
+	compiled->parameters[i] = parameters[i];
+    }
+  return compiled;
+}
 
-  digits = (flags & FLAGS_UPPER) ? internalDigitsUpper : internalDigitsLower;
-  if (base == NO_BASE)
-    base = BASE_DECIMAL;
+/*************************************************************************
+ * TrioUncompile
+ */
+TRIO_PRIVATE void
+TrioUncompile
+TRIO_ARGS1((compiled),
+	   trio_compiled_t *compiled)
+{
+  trio_destroy(compiled->format);
+  TRIO_FREE(compiled);
+}
 
-  isNumberZero = (number == 0);
-  isPrecisionZero = (precision == 0);
-  ignoreNumber = (isNumberZero
-		  && isPrecisionZero
-		  && !((flags & FLAGS_ALTERNATIVE) && (base == BASE_OCTAL)));
+/*************************************************************************
+ * TrioUseCompiled
+ *
+ * Description:
+ *  Copy the entries of a compiled formatting string into @parameters,
+ *  ready for TrioReadArguments. Only the fields set by the parser are
+ *  copied, as the entries are fairly large.
+ */
+TRIO_PRIVATE void
+TrioUseCompiled
+TRIO_ARGS2((compiled, parameters),
+	   TRIO_CONST trio_compiled_t *compiled,
+	   trio_parameter_t *parameters)
+{
+  TRIO_CONST trio_parameter_t *source;
+  int i;
 
-  if (flags & FLAGS_UNSIGNED)
+  for (i = 0; i < compiled->count; i++)
     {
-      isNegative = FALSE;
-      flags &= ~FLAGS_SHOWSIGN;
+      source = &compiled->parameters[i];
+      parameters[i].type = source->type;
+      parameters[i].flags = source->flags;
+      parameters[i].width = source->width;
+      parameters[i].precision = source->precision;
+      parameters[i].base = source->base;
+      parameters[i].varsize = source->varsize;
+      parameters[i].indexAfterSpecifier = source->indexAfterSpecifier;
+#if defined(FORMAT_USER_DEFINED)
+      if (source->type == FORMAT_USER_DEFINED)
+	{
+	  trio_copy_max(parameters[i].user_name, MAX_USER_NAME,
+			source->user_name);
+	  trio_copy_max(parameters[i].user_data, MAX_USER_DATA,
+			source->user_data);
+	}
+#endif
     }
-  else
-    {
-      isNegative = ((trio_intmax_t)number < 0);
+}
+
+/*************************************************************************
+ * TrioParseCached
+ *
+ * Description:
+ *  TrioParse for the printf family. The parsed formatting strings are
+ *  remembered by address, and checked against a copy before use, since
+ *  the same buffer may hold different strings over time. A formatting
+ *  string is only compiled the second time in a row it is seen at an
+ *  address, so that strings built on the fly do not cost an allocation
+ *  each.
+ *
+ *  The cache has its own lock. It is only ever tried: a thread finding
+ *  it taken parses the string itself rather than wait.
+ */
+TRIO_PRIVATE int
+TrioParseCached
+TRIO_ARGS4((format, parameters, arglist, argarray),
+	   TRIO_CONST char *format,
+	   trio_parameter_t *parameters,
+	   TRIO_VA_LIST_PTR arglist,
+	   trio_pointer_t *argarray)
+{
+#if defined(TRIO_FORMAT_CACHE)
+  int indices[MAX_PARAMETERS];
+  trio_compiled_t *compiled;
+  trio_compiled_t *unused = NULL;
+  size_t slot;
+  int arguments = -1;
+  int count;
+  int i;
+
+  slot = ((size_t)format ^ ((size_t)format >> 6)) % FORMAT_CACHE_SIZE;
+
+  if (!__atomic_exchange_n(&internalFormatCacheLock, 1, __ATOMIC_ACQUIRE))
+    {
+      compiled = internalFormatCache[slot].compiled;
+      if ((internalFormatCache[slot].format == format) &&
+	  (compiled != NULL) &&
+	  trio_equal_case(compiled->format, format))
+	{
+	  TrioUseCompiled(compiled, parameters);
+	  arguments = compiled->arguments;
+	  for (i = 0; i < arguments; i++)
+	    indices[i] = compiled->indices[i];
+	}
+      __atomic_store_n(&internalFormatCacheLock, 0, __ATOMIC_RELEASE);
+    }
+
+  if (arguments < 0)
+    {
+      arguments = TrioParseSpecifiers(TYPE_PRINT, format, parameters,
+				      indices, &count);
+      if (arguments < 0)
+	return arguments;
+
+      if (!__atomic_exchange_n(&internalFormatCacheLock, 1, __ATOMIC_ACQUIRE))
+	{
+	  unused = internalFormatCache[slot].compiled;
+	  if ((internalFormatCache[slot].format == format) && (unused == NULL))
+	    {
+	      internalFormatCache[slot].compiled =
+		TrioCompile(format, parameters, indices, arguments, count);
+	    }
+	  else
+	    {
+	      internalFormatCache[slot].format = format;
+	      internalFormatCache[slot].compiled = NULL;
+	    }
+	  __atomic_store_n(&internalFormatCacheLock, 0, __ATOMIC_RELEASE);
+	}
+
+      /* Out of the cache, no other thread can be using it */
+      if (unused)
+	TrioUncompile(unused);
+    }
+
+  return TrioReadArguments(TYPE_PRINT, parameters, indices, arguments,
+			   arglist, argarray);
+#else
+  return TrioParse(TYPE_PRINT, format, parameters, arglist, argarray);
+#endif
+}
+
+
+/*************************************************************************
+ *
+ * FORMATTING
+ *
+ ************************************************************************/
+
+
+/*************************************************************************
+ * TrioWriteSpan
+ *
+ * Description:
+ *  Output @length characters at once, if the stream allows it.
+ */
+TRIO_PRIVATE void
+TrioWriteSpan
+TRIO_ARGS3((self, string, length),
+	   trio_class_t *self,
+	   TRIO_CONST char *string,
+	   int length)
+{
+  if (self->OutSpan)
+    {
+      if (length > 0)
+	self->OutSpan(self, string, length);
+    }
+  else
+    {
+      while (length-- > 0)
+	self->OutStream(self, *string++);
+    }
+}
+
+/*************************************************************************
+ * TrioWriteRepeat
+ *
+ * Description:
+ *  Output @count copies of a padding character.
+ */
+TRIO_PRIVATE void
+TrioWriteRepeat
+TRIO_ARGS3((self, ch, count),
+	   trio_class_t *self,
+	   int ch,
+	   int count)
+{
+  char chunk[PADDING_CHUNK_SIZE];
+  int length;
+
+  if (self->OutSpan)
+    {
+      if (count <= 0)
+	return;
+      length = (count < (int)sizeof(chunk)) ? count : (int)sizeof(chunk);
+      memset(chunk, ch, length);
+      while (count > 0)
+	{
+	  if (length > count)
+	    length = count;
+	  self->OutSpan(self, chunk, length);
+	  count -= length;
+	}
+    }
+  else
+    {
+      while (count-- > 0)
+	self->OutStream(self, ch);
+    }
+}
+
+/*************************************************************************
+ * TrioWriteNumber
+ *
+ * Description:
+ *  Output a number.
+ *  The complexity of this function is a result of the complexity
+ *  of the dependencies of the flags.
+ */
+TRIO_PRIVATE void
+TrioWriteNumber
+TRIO_ARGS6((self, number, flags, width, precision, base),
+	   trio_class_t *self,
+	   trio_uintmax_t number,
+	   trio_flags_t flags,
+	   int width,
+	   int precision,
+	   int base)
+{
+  BOOLEAN_T isNegative;
+  BOOLEAN_T isNumberZero;
+  BOOLEAN_T isPrecisionZero;
+  BOOLEAN_T ignoreNumber;
+  char buffer[MAX_CHARS_IN(trio_uintmax_t) * (1 + MAX_LOCALE_SEPARATOR_LENGTH) + 1];
+  char *bufferend;
+  char *pointer;
+  TRIO_CONST char *digits;
+  int i;
+  int length;
+  char *p;
+  int count;
+  int shift;
+
+  assert(VALID(self));
+  assert(VALID(self->OutStream));
+  assert(((base >= MIN_BASE) && (base <= MAX_BASE)) || (base == NO_BASE));
+
+  digits = (flags & FLAGS_UPPER) ? internalDigitsUpper : internalDigitsLower;
+  if (base == NO_BASE)
+    base = BASE_DECIMAL;
+
+  isNumberZero = (number == 0);
+  isPrecisionZero = (precision == 0);
+  ignoreNumber = (isNumberZero
+		  && isPrecisionZero
+		  && !((flags & FLAGS_ALTERNATIVE) && (base == BASE_OCTAL)));
+
+  if (flags & FLAGS_UNSIGNED)
+    {
+      isNegative = FALSE;
+      flags &= ~FLAGS_SHOWSIGN;
+    }
+  else
+    {
+      isNegative = ((trio_intmax_t)number < 0);
       if (isNegative)
 	number = -((trio_intmax_t)number);
     }
@@ -2237,26 +3031,62 @@ TRIO_ARGS6((self, number, flags, width, precision, base),
   /* Build number */
   pointer = bufferend = &buffer[sizeof(buffer) - 1];
   *pointer-- = NIL;
-  for (i = 1; i < (int)sizeof(buffer); i++)
+  if ((base == BASE_DECIMAL) && !(flags & FLAGS_QUOTE))
     {
-      *pointer-- = digits[number % base];
-      number /= base;
-      if (number == 0)
-	break;
-
-      if ((flags & FLAGS_QUOTE) && TrioFollowedBySeparator(i + 1))
+      /* Two digits per division */
+      while (number >= 100)
 	{
-	  /*
-	   * We are building the number from the least significant
-	   * to the most significant digit, so we have to copy the
-	   * thousand separator backwards
-	   */
-	  length = internalThousandSeparatorLength;
-	  if (((int)(pointer - buffer) - length) > 0)
+	  i = (int)(number % 100) * 2;
+	  number /= 100;
+	  *pointer-- = internalDigitPairs[i + 1];
+	  *pointer-- = internalDigitPairs[i];
+	}
+      if (number >= 10)
+	{
+	  i = (int)number * 2;
+	  *pointer-- = internalDigitPairs[i + 1];
+	  *pointer-- = internalDigitPairs[i];
+	}
+      else
+	{
+	  *pointer-- = digits[number];
+	}
+    }
+  else if (((base & (base - 1)) == 0) && !(flags & FLAGS_QUOTE))
+    {
+      /* Powers of two need no division at all */
+      for (shift = 0; (1 << shift) < base; shift++)
+	continue;
+      do
+	{
+	  *pointer-- = digits[number & (base - 1)];
+	  number >>= shift;
+	}
+      while (number != 0);
+    }
+  else
+    {
+      for (i = 1; i < (int)sizeof(buffer); i++)
+	{
+	  *pointer-- = digits[number % base];
+	  number /= base;
+	  if (number == 0)
+	    break;
+
+	  if ((flags & FLAGS_QUOTE) && TrioFollowedBySeparator(i + 1))
 	    {
-	      p = &internalThousandSeparator[length - 1];
-	      while (length-- > 0)
-		*pointer-- = *p--;
+	      /*
+	       * We are building the number from the least significant
+	       * to the most significant digit, so we have to copy the
+	       * thousand separator backwards
+	       */
+	      length = internalThousandSeparatorLength;
+	      if (((int)(pointer - buffer) - length) > 0)
+		{
+		  p = &internalThousandSeparator[length - 1];
+		  while (length-- > 0)
+		    *pointer-- = *p--;
+		}
 	    }
 	}
     }
@@ -2305,8 +3135,12 @@ TRIO_ARGS6((self, number, flags, width, precision, base),
   if (! ((flags & FLAGS_LEFTADJUST) ||
 	 ((flags & FLAGS_NILPADDING) && (precision == NO_PRECISION))))
     {
-      while (width-- > count)
-	self->OutStream(self, CHAR_ADJUST);
+      if (width > count)
+	{
+	  TrioWriteRepeat(self, CHAR_ADJUST, width - count);
+	  width = count;
+	}
+      width--;
     }
 
   /* width has been adjusted for signs and alternatives */
@@ -2347,28 +3181,22 @@ TRIO_ARGS6((self, number, flags, width, precision, base),
     {
       if (precision == NO_PRECISION)
 	precision = width;
-      while (precision-- > 0)
+      if (precision > 0)
 	{
-	  self->OutStream(self, '0');
-	  width--;
+	  TrioWriteRepeat(self, '0', precision);
+	  width -= precision;
 	}
     }
 
   if (! ignoreNumber)
     {
       /* Output the number itself */
-      while (*(++pointer))
-	{
-	  self->OutStream(self, *pointer);
-	}
+      TrioWriteSpan(self, pointer + 1, (int)(bufferend - pointer) - 1);
     }
 
   /* Output trailing spaces if needed */
   if (flags & FLAGS_LEFTADJUST)
-    {
-      while (width-- > 0)
-	self->OutStream(self, CHAR_ADJUST);
-    }
+    TrioWriteRepeat(self, CHAR_ADJUST, width);
 }
 
 /*************************************************************************
@@ -2471,23 +3299,25 @@ TRIO_ARGS5((self, string, flags, width, precision),
     self->OutStream(self, CHAR_QUOTE);
 
   if (! (flags & FLAGS_LEFTADJUST))
+    TrioWriteRepeat(self, CHAR_ADJUST, width);
+
+  if (flags & FLAGS_ALTERNATIVE)
     {
-      while (width-- > 0)
-	self->OutStream(self, CHAR_ADJUST);
+      while (length-- > 0)
+	{
+	  /* The ctype parameters must be an unsigned char (or EOF) */
+	  ch = (int)((unsigned char)(*string++));
+	  TrioWriteStringCharacter(self, ch, flags);
+	}
     }
-
-  while (length-- > 0)
+  else
     {
-      /* The ctype parameters must be an unsigned char (or EOF) */
-      ch = (int)((unsigned char)(*string++));
-      TrioWriteStringCharacter(self, ch, flags);
+      /* Nothing to escape */
+      TrioWriteSpan(self, string, length);
     }
 
   if (flags & FLAGS_LEFTADJUST)
-    {
-      while (width-- > 0)
-	self->OutStream(self, CHAR_ADJUST);
-    }
+    TrioWriteRepeat(self, CHAR_ADJUST, width);
   if (flags & FLAGS_QUOTE)
     self->OutStream(self, CHAR_QUOTE);
 }
@@ -2658,6 +3488,15 @@ TRIO_ARGS6((self, number, flags, width, precision, base),
   BOOLEAN_T keepTrailingZeroes;
   BOOLEAN_T keepDecimalPoint;
   trio_long_double_t epsilon;
+#if defined(TRIO_SHORTEST_DOUBLE)
+  char shortest[32];
+  int shortestLength = 0;
+  int shortestExponent = 0;
+  int shortestLimit;
+  int shortestLowest;
+  int lowestPosition;
+  trio_flags_t shortestFlags;
+#endif
 
   assert(VALID(self));
   assert(VALID(self->OutStream));
@@ -2752,101 +3591,201 @@ TRIO_ARGS6((self, number, flags, width, precision, base),
   if (isNegative)
     number = -number;
 
-  if (isHex)
-    flags |= FLAGS_FLOAT_E;
-
-  if (flags & FLAGS_FLOAT_G)
+#if defined(TRIO_SHORTEST_DOUBLE)
+  /*
+   * Subnormals have too few bits for the rounding argument below. Only
+   * as many digits as will be output are of any use, and there must be
+   * no more than DBL_DIG of them.
+   */
+  if ((base == BASE_DECIMAL) && !(flags & (FLAGS_LONGDOUBLE | FLAGS_ROUNDING)) &&
+      ((number == 0.0) || (number >= DBL_MIN)))
     {
-      if (precision == 0)
-	precision = 1;
-
-      if ((number < 1.0E-4) || (number > powl(base,
-					      (trio_long_double_t)precision)))
+      if (flags & FLAGS_FLOAT_G)
 	{
-	  /* Use scientific notation */
-	  flags |= FLAGS_FLOAT_E;
+	  shortestLimit = (precision == 0) ? 1 : precision;
+	  shortestLowest = INT_MIN;
 	}
-      else if (number < 1.0)
-	{
-	  /*
-	   * Use normal notation. If the integer part of the number is
-	   * zero, then adjust the precision to include leading fractional
-	   * zeros.
-	   */
-	  workNumber = TrioLogarithm(number, base);
-	  workNumber = TRIO_FABS(workNumber);
-	  if (workNumber - floorl(workNumber) < 0.001)
-	    workNumber--;
-	  zeroes = (int)floorl(workNumber);
-	}
-    }
-
-  if (flags & FLAGS_FLOAT_E)
-    {
-      /* Scale the number */
-      workNumber = TrioLogarithm(number, base);
-      if (trio_isinf(workNumber) == -1)
+      else if (flags & FLAGS_FLOAT_E)
 	{
-	  exponent = 0;
-	  /* Undo setting */
-	  if (flags & FLAGS_FLOAT_G)
-	    flags &= ~FLAGS_FLOAT_E;
+	  shortestLimit = precision + 1;
+	  shortestLowest = INT_MIN;
 	}
       else
 	{
-	  exponent = (int)floorl(workNumber);
-	  number /= powl(dblBase, (trio_long_double_t)exponent);
-	  isExponentNegative = (exponent < 0);
-	  uExponent = (isExponentNegative) ? -exponent : exponent;
-	  if (isHex)
-	    uExponent *= 4; /* log16(2) */
-	  /* No thousand separators */
-	  flags &= ~FLAGS_QUOTE;
+	  shortestLimit = (precision < DBL_DIG) ? DBL_DIG : 0;
+	  shortestLowest = -precision;
 	}
+      if ((shortestLimit > 0) && (shortestLimit <= DBL_DIG))
+	shortestLength = TrioShortestDigits((double)number, shortestLimit,
+					    shortestLowest, shortest,
+					    &shortestExponent);
     }
+#endif
 
-  integerNumber = floorl(number);
-  fractionNumber = number - integerNumber;
+  if (isHex)
+    flags |= FLAGS_FLOAT_E;
 
+#if defined(TRIO_SHORTEST_DOUBLE)
   /*
-   * Truncated number.
-   *
-   * Precision is number of significant digits for FLOAT_G
-   * and number of fractional digits for others.
+   * The digits to output can be taken from the shortest representation
+   * if it has no digit beyond the last one to output, and no more than
+   * DBL_DIG digits are output from the first significant one. The number
+   * is then closer to the representation than to any other number with
+   * that many digits, so the representation is the correctly rounded
+   * output, and the layout follows from its exponent without any
+   * logarithms. Otherwise everything is computed the long way below.
    */
-  integerDigits = (integerNumber > epsilon)
-    ? 1 + (int)TrioLogarithm(integerNumber, base)
-    : 1;
-  fractionDigits = ((flags & FLAGS_FLOAT_G) && (zeroes == 0))
-    ? precision - integerDigits
-    : zeroes + precision;
-
-  dblFractionBase = TrioPower(base, fractionDigits);
-
-  workNumber = number + 0.5 / dblFractionBase;
-  if (floorl(number) != floorl(workNumber))
+  if (shortestLength > 0)
     {
-      if (flags & FLAGS_FLOAT_E)
+      shortestFlags = flags;
+      if (shortestFlags & FLAGS_FLOAT_G)
 	{
-	  /* Adjust if number was rounded up one digit (ie. 0.99 to 1.00) */
-	  exponent++;
-	  isExponentNegative = (exponent < 0);
-	  uExponent = (isExponentNegative) ? -exponent : exponent;
-	  if (isHex)
-	    uExponent *= 4; /* log16(2) */
-	  workNumber = (number + 0.5 / dblFractionBase) / dblBase;
-	  integerNumber = floorl(workNumber);
-	  fractionNumber = workNumber - integerNumber;
+	  if (precision == 0)
+	    precision = 1;
+
+	  if ((shortestExponent < -4) ||
+	      (shortestExponent > precision) ||
+	      ((shortestExponent == precision) && (shortestLength > 1)))
+	    shortestFlags |= FLAGS_FLOAT_E;
+	  else if (shortestExponent < 0)
+	    shortestLength = 0; /* Leading fractional zeroes */
+	}
+      if (shortestFlags & FLAGS_FLOAT_E)
+	{
+	  exponent = shortestExponent;
+	  integerDigits = 1;
 	}
       else
 	{
-	  /* Adjust if number was rounded up one digit (ie. 99 to 100) */
-	  integerNumber = floorl(number + 0.5);
+	  exponent = 0;
+	  integerDigits = (shortestExponent > 0) ? shortestExponent + 1 : 1;
+	}
+      fractionDigits = (shortestFlags & FLAGS_FLOAT_G)
+	? precision - integerDigits
+	: precision;
+      lowestPosition = exponent - fractionDigits;
+      if ((fractionDigits < 0) ||
+	  (shortestExponent - shortestLength + 1 < lowestPosition) ||
+	  (shortestExponent - lowestPosition >= DBL_DIG))
+	shortestLength = 0;
+
+      if (shortestLength > 0)
+	{
+	  flags = shortestFlags;
+	  /* Unused, the digits come from the shortest representation */
+	  integerNumber = 0.0;
 	  fractionNumber = 0.0;
-	  integerDigits = (integerNumber > epsilon)
-	    ? 1 + (int)TrioLogarithm(integerNumber, base)
-	    : 1;
+	  dblFractionBase = 1.0;
+	  if (flags & FLAGS_FLOAT_E)
+	    {
+	      isExponentNegative = (exponent < 0);
+	      uExponent = (isExponentNegative) ? -exponent : exponent;
+	      /* No thousand separators */
+	      flags &= ~FLAGS_QUOTE;
+	    }
 	}
+      else
+	{
+	  exponent = 0;
+	}
+    }
+
+  if (shortestLength == 0)
+#endif
+    {
+    if (flags & FLAGS_FLOAT_G)
+      {
+	if (precision == 0)
+	  precision = 1;
+
+	if ((number < 1.0E-4) || (number > powl(base,
+						(trio_long_double_t)precision)))
+	  {
+	    /* Use scientific notation */
+	    flags |= FLAGS_FLOAT_E;
+	  }
+	else if (number < 1.0)
+	  {
+	    /*
+	     * Use normal notation. If the integer part of the number is
+	     * zero, then adjust the precision to include leading fractional
+	     * zeros.
+	     */
+	    workNumber = TrioLogarithm(number, base);
+	    workNumber = TRIO_FABS(workNumber);
+	    if (workNumber - floorl(workNumber) < 0.001)
+	      workNumber--;
+	    zeroes = (int)floorl(workNumber);
+	  }
+      }
+
+    if (flags & FLAGS_FLOAT_E)
+      {
+	/* Scale the number */
+	workNumber = TrioLogarithm(number, base);
+	if (trio_isinf(workNumber) == -1)
+	  {
+	    exponent = 0;
+	    /* Undo setting */
+	    if (flags & FLAGS_FLOAT_G)
+	      flags &= ~FLAGS_FLOAT_E;
+	  }
+	else
+	  {
+	    exponent = (int)floorl(workNumber);
+	    number /= powl(dblBase, (trio_long_double_t)exponent);
+	    isExponentNegative = (exponent < 0);
+	    uExponent = (isExponentNegative) ? -exponent : exponent;
+	    if (isHex)
+	      uExponent *= 4; /* log16(2) */
+	    /* No thousand separators */
+	    flags &= ~FLAGS_QUOTE;
+	  }
+      }
+
+    integerNumber = floorl(number);
+    fractionNumber = number - integerNumber;
+
+    /*
+     * Truncated number.
+     *
+     * Precision is number of significant digits for FLOAT_G
+     * and number of fractional digits for others.
+     */
+    integerDigits = (integerNumber > epsilon)
+      ? 1 + (int)TrioLogarithm(integerNumber, base)
+      : 1;
+    fractionDigits = ((flags & FLAGS_FLOAT_G) && (zeroes == 0))
+      ? precision - integerDigits
+      : zeroes + precision;
+
+    dblFractionBase = TrioPower(base, fractionDigits);
+
+    workNumber = number + 0.5 / dblFractionBase;
+    if (floorl(number) != floorl(workNumber))
+      {
+	if (flags & FLAGS_FLOAT_E)
+	  {
+	    /* Adjust if number was rounded up one digit (ie. 0.99 to 1.00) */
+	    exponent++;
+	    isExponentNegative = (exponent < 0);
+	    uExponent = (isExponentNegative) ? -exponent : exponent;
+	    if (isHex)
+	      uExponent *= 4; /* log16(2) */
+	    workNumber = (number + 0.5 / dblFractionBase) / dblBase;
+	    integerNumber = floorl(workNumber);
+	    fractionNumber = workNumber - integerNumber;
+	  }
+	else
+	  {
+	    /* Adjust if number was rounded up one digit (ie. 99 to 100) */
+	    integerNumber = floorl(number + 0.5);
+	    fractionNumber = 0.0;
+	    integerDigits = (integerNumber > epsilon)
+	      ? 1 + (int)TrioLogarithm(integerNumber, base)
+	      : 1;
+	  }
+      }
     }
 
   /* Estimate accuracy */
@@ -2881,17 +3820,24 @@ TRIO_ARGS6((self, number, flags, width, precision, base),
    *  sign + integer part + thousands separators + decimal point
    *  + fraction + exponent
    */
-  fractionAdjust /= dblFractionBase;
-  hasOnlyZeroes = (floorl((fractionNumber + fractionAdjust) * dblFractionBase) < epsilon);
+#if defined(TRIO_SHORTEST_DOUBLE)
+  if (shortestLength > 0)
+    hasOnlyZeroes = (shortestExponent - shortestLength + 1 >= exponent);
+  else
+#endif
+    {
+      fractionAdjust /= dblFractionBase;
+      hasOnlyZeroes = (floorl((fractionNumber + fractionAdjust) * dblFractionBase) < epsilon);
+    }
   keepDecimalPoint = ( (flags & FLAGS_ALTERNATIVE) ||
 		       !((precision == 0) ||
 			 (!keepTrailingZeroes && hasOnlyZeroes)) );
   if (flags & FLAGS_FLOAT_E)
     {
-      exponentDigits = (uExponent == 0)
-	? 1
-	: (int)ceil(TrioLogarithm((double)(uExponent + 1),
-				  (isHex) ? 10.0 : base));
+      /* The exponent is always written in decimal */
+      exponentDigits = 1;
+      for (exponentBase = 10; uExponent >= (unsigned int)exponentBase; exponentBase *= 10)
+	exponentDigits++;
     }
   else
     exponentDigits = 0;
@@ -2928,23 +3874,13 @@ TRIO_ARGS6((self, number, flags, width, precision, base),
 	  self->OutStream(self, (flags & FLAGS_UPPER) ? 'X' : 'x');
 	}
       if (!(flags & FLAGS_LEFTADJUST))
-	{
-	  for (i = expectedWidth; i < width; i++)
-	    {
-	      self->OutStream(self, '0');
-	    }
-	}
+	TrioWriteRepeat(self, '0', width - expectedWidth);
     }
   else
     {
       /* Leading spaces must be before sign */
       if (!(flags & FLAGS_LEFTADJUST))
-	{
-	  for (i = expectedWidth; i < width; i++)
-	    {
-	      self->OutStream(self, CHAR_ADJUST);
-	    }
-	}
+	TrioWriteRepeat(self, CHAR_ADJUST, width - expectedWidth);
       if (isNegative)
 	self->OutStream(self, '-');
       else if (flags & FLAGS_SHOWSIGN)
@@ -2962,14 +3898,23 @@ TRIO_ARGS6((self, number, flags, width, precision, base),
   dblIntegerBase = 1.0 / TrioPower(base, integerDigits - 1);
   for (i = 0; i < integerDigits; i++)
     {
-      workNumber = floorl(((integerNumber + integerAdjust) * dblIntegerBase));
       if (i > integerThreshold)
 	{
 	  /* Beyond accuracy */
 	  self->OutStream(self, digits[0]);
 	}
+#if defined(TRIO_SHORTEST_DOUBLE)
+      else if (shortestLength > 0)
+	{
+	  self->OutStream(self,
+			  digits[TrioShortestDigit(shortest, shortestLength,
+						   shortestExponent,
+						   exponent + integerDigits - 1 - i)]);
+	}
+#endif
       else
 	{
+	  workNumber = floorl(((integerNumber + integerAdjust) * dblIntegerBase));
 	  self->OutStream(self, digits[(int)fmodl(workNumber, dblBase)]);
 	}
       dblIntegerBase *= dblBase;
@@ -3013,11 +3958,21 @@ TRIO_ARGS6((self, number, flags, width, precision, base),
 	}
       else
 	{
-	  fractionNumber *= dblBase;
-	  fractionAdjust *= dblBase;
-	  workNumber = floorl(fractionNumber + fractionAdjust);
-	  fractionNumber -= workNumber;
-	  index = (int)fmodl(workNumber, dblBase);
+#if defined(TRIO_SHORTEST_DOUBLE)
+	  if (shortestLength > 0)
+	    {
+	      index = TrioShortestDigit(shortest, shortestLength,
+					shortestExponent, exponent - i - 1);
+	    }
+	  else
+#endif
+	    {
+	      fractionNumber *= dblBase;
+	      fractionAdjust *= dblBase;
+	      workNumber = floorl(fractionNumber + fractionAdjust);
+	      fractionNumber -= workNumber;
+	      index = (int)fmodl(workNumber, dblBase);
+	    }
 	  if (index == 0)
 	    {
 	      trailingZeroes++;
@@ -3068,12 +4023,7 @@ TRIO_ARGS6((self, number, flags, width, precision, base),
     }
   /* Output trailing spaces */
   if (flags & FLAGS_LEFTADJUST)
-    {
-      for (i = expectedWidth; i < width; i++)
-	{
-	  self->OutStream(self, CHAR_ADJUST);
-	}
-    }
+    TrioWriteRepeat(self, CHAR_ADJUST, width - expectedWidth);
 }
 
 /*************************************************************************
@@ -3100,6 +4050,7 @@ TRIO_ARGS3((data, format, parameters),
   int precision;
   int base;
   int index;
+  int literal;
 
   index = 0;
   i = 0;
@@ -3120,10 +4071,8 @@ TRIO_ARGS3((data, format, parameters),
 	   */
 	  if (charlen != -1)
 	    {
-	      while (charlen-- > 0)
-		{
-		  data->OutStream(data, format[index++]);
-		}
+	      TrioWriteSpan(data, &format[index], charlen);
+	      index += charlen;
 	      continue; /* while characters left in formatting string */
 	    }
 	}
@@ -3285,8 +4234,11 @@ TRIO_ARGS3((data, format, parameters),
 		      /*
 		       * C99 paragraph 7.19.6.1.8 says "the number of
 		       * characters written to the output stream so far by
-		       * this call", which is data->committed
+		       * this call", which is data->committed once the
+		       * buffered ones are written
 		       */
+		      if (data->OutFlush)
+			data->OutFlush(data);
 #if defined(QUALIFIER_SIZE_T) || defined(QUALIFIER_SIZE_T_UPPER)
 		      if (flags & FLAGS_SIZE_T)
 			*(size_t *)pointer = (size_t)data->committed;
@@ -3386,7 +4338,16 @@ TRIO_ARGS3((data, format, parameters),
 	}
       else /* not identifier */
 	{
-	  data->OutStream(data, format[index++]);
+	  /* Output the run of plain characters up to the next specifier */
+	  literal = index + 1;
+	  while (format[literal] && (CHAR_IDENTIFIER != format[literal])
+#if defined(TRIO_COMPILER_SUPPORTS_MULTIBYTE)
+		 && isascii(format[literal])
+#endif
+		 )
+	    literal++;
+	  TrioWriteSpan(data, &format[index], literal - index);
+	  index = literal;
 	}
     }
   return data->processed;
@@ -3406,7 +4367,7 @@ TRIO_ARGS4((reference, format, arglist, argarray),
   int status;
   trio_parameter_t parameters[MAX_PARAMETERS];
 
-  status = TrioParse(TYPE_PRINT, format, parameters, arglist, argarray);
+  status = TrioParseCached(format, parameters, arglist, argarray);
   if (status < 0)
     return status;
 
@@ -3423,26 +4384,36 @@ TRIO_ARGS4((reference, format, arglist, argarray),
  */
 TRIO_PRIVATE int
 TrioFormat
-TRIO_ARGS6((destination, destinationSize, OutStream, format, arglist, argarray),
+TRIO_ARGS6((destination, destinationSize, output, format, arglist, argarray),
 	   trio_pointer_t destination,
 	   size_t destinationSize,
-	   void (*OutStream) TRIO_PROTO((trio_class_t *, int)),
+	   TRIO_CONST trio_output_t *output,
 	   TRIO_CONST char *format,
 	   TRIO_VA_LIST_PTR arglist,
 	   trio_pointer_t *argarray)
 {
   int status;
   trio_class_t data;
+  trio_buffer_t buffer;
   trio_parameter_t parameters[MAX_PARAMETERS];
 
-  assert(VALID(OutStream));
+  assert(VALID(output));
   assert(VALID(format));
 
   memset(&data, 0, sizeof(data));
-  data.OutStream = OutStream;
+  data.OutStream = output->OutStream;
+  data.OutSpan = output->OutSpan;
+  data.OutFlush = output->OutFlush;
   data.location = destination;
   data.max = destinationSize;
   data.error = 0;
+  if (data.OutFlush)
+    {
+      /* Buffered streams write through the buffer to the destination */
+      buffer.target = destination;
+      buffer.length = 0;
+      data.location = &buffer;
+    }
 
 #if defined(USE_LOCALE)
   if (NULL == internalLocaleValues)
@@ -3451,11 +4422,13 @@ TRIO_ARGS6((destination, destinationSize, OutStream, format, arglist, argarray),
     }
 #endif
 
-  status = TrioParse(TYPE_PRINT, format, parameters, arglist, argarray);
+  status = TrioParseCached(format, parameters, arglist, argarray);
   if (status < 0)
     return status;
 
   status = TrioFormatProcess(&data, format, parameters);
+  if (data.OutFlush)
+    data.OutFlush(&data);
   if (data.error != 0)
     {
       status = data.error;
@@ -3464,56 +4437,175 @@ TRIO_ARGS6((destination, destinationSize, OutStream, format, arglist, argarray),
 }
 
 /*************************************************************************
- * TrioOutStreamFile
+ * TrioFormatCompiled
+ */
+TRIO_PRIVATE int
+TrioFormatCompiled
+TRIO_ARGS6((destination, destinationSize, output, compiled, arglist, argarray),
+	   trio_pointer_t destination,
+	   size_t destinationSize,
+	   TRIO_CONST trio_output_t *output,
+	   TRIO_CONST trio_compiled_t *compiled,
+	   TRIO_VA_LIST_PTR arglist,
+	   trio_pointer_t *argarray)
+{
+  int status;
+  trio_class_t data;
+  trio_buffer_t buffer;
+  trio_parameter_t parameters[MAX_PARAMETERS];
+
+  assert(VALID(output));
+  assert(VALID(compiled));
+
+  memset(&data, 0, sizeof(data));
+  data.OutStream = output->OutStream;
+  data.OutSpan = output->OutSpan;
+  data.OutFlush = output->OutFlush;
+  data.location = destination;
+  data.max = destinationSize;
+  data.error = 0;
+  if (data.OutFlush)
+    {
+      /* Buffered streams write through the buffer to the destination */
+      buffer.target = destination;
+      buffer.length = 0;
+      data.location = &buffer;
+    }
+
+#if defined(USE_LOCALE)
+  if (NULL == internalLocaleValues)
+    {
+      TrioSetLocale();
+    }
+#endif
+
+  TrioUseCompiled(compiled, parameters);
+  status = TrioReadArguments(TYPE_PRINT, parameters, compiled->indices,
+			     compiled->arguments, arglist, argarray);
+  if (status < 0)
+    return status;
+
+  status = TrioFormatProcess(&data, compiled->format, parameters);
+  if (data.OutFlush)
+    data.OutFlush(&data);
+  if (data.error != 0)
+    {
+      status = data.error;
+    }
+  return status;
+}
+
+/*************************************************************************
+ * TrioOutStreamBuffered
  */
 TRIO_PRIVATE void
-TrioOutStreamFile
+TrioOutStreamBuffered
 TRIO_ARGS2((self, output),
 	   trio_class_t *self,
 	   int output)
 {
-  FILE *file;
+  trio_buffer_t *buffer;
 
   assert(VALID(self));
   assert(VALID(self->location));
 
-  file = (FILE *)self->location;
+  buffer = (trio_buffer_t *)self->location;
+  if (buffer->length == (int)sizeof(buffer->data))
+    self->OutFlush(self);
+  buffer->data[buffer->length++] = (char)output;
   self->processed++;
-  if (fputc(output, file) == EOF)
+}
+
+/*************************************************************************
+ * TrioOutSpanBuffered
+ */
+TRIO_PRIVATE void
+TrioOutSpanBuffered
+TRIO_ARGS3((self, string, length),
+	   trio_class_t *self,
+	   TRIO_CONST char *string,
+	   int length)
+{
+  trio_buffer_t *buffer;
+  int size;
+
+  assert(VALID(self));
+  assert(VALID(self->location));
+
+  buffer = (trio_buffer_t *)self->location;
+  self->processed += length;
+  while (length > 0)
     {
-      self->error = TRIO_ERROR_RETURN(TRIO_EOF, 0);
+      if (buffer->length == (int)sizeof(buffer->data))
+	self->OutFlush(self);
+      size = (int)sizeof(buffer->data) - buffer->length;
+      if (size > length)
+	size = length;
+      memcpy(&buffer->data[buffer->length], string, size);
+      buffer->length += size;
+      string += size;
+      length -= size;
     }
-  else
+}
+
+/*************************************************************************
+ * TrioOutFlushFile
+ */
+TRIO_PRIVATE void
+TrioOutFlushFile
+TRIO_ARGS1((self),
+	   trio_class_t *self)
+{
+  trio_buffer_t *buffer;
+  size_t written;
+
+  assert(VALID(self));
+  assert(VALID(self->location));
+
+  buffer = (trio_buffer_t *)self->location;
+  if (buffer->length > 0)
     {
-      self->committed++;
+      written = fwrite(buffer->data, sizeof(char), (size_t)buffer->length,
+		       (FILE *)buffer->target);
+      self->committed += (int)written;
+      if (written < (size_t)buffer->length)
+	{
+	  self->error = TRIO_ERROR_RETURN(TRIO_EOF, 0);
+	}
+      buffer->length = 0;
     }
 }
 
 /*************************************************************************
- * TrioOutStreamFileDescriptor
+ * TrioOutFlushFileDescriptor
  */
 TRIO_PRIVATE void
-TrioOutStreamFileDescriptor
-TRIO_ARGS2((self, output),
-	   trio_class_t *self,
-	   int output)
+TrioOutFlushFileDescriptor
+TRIO_ARGS1((self),
+	   trio_class_t *self)
 {
+  trio_buffer_t *buffer;
   int fd;
-  char ch;
+  int offset;
+  int written;
 
   assert(VALID(self));
+  assert(VALID(self->location));
 
-  fd = *((int *)self->location);
-  ch = (char)output;
-  self->processed++;
-  if (write(fd, &ch, sizeof(char)) == -1)
-    {
-      self->error = TRIO_ERROR_RETURN(TRIO_ERRNO, 0);
-    }
-  else
+  buffer = (trio_buffer_t *)self->location;
+  fd = *((int *)buffer->target);
+  for (offset = 0; offset < buffer->length; offset += written)
     {
-      self->committed++;
+      written = (int)write(fd, &buffer->data[offset],
+			   (size_t)(buffer->length - offset));
+      if (written == -1)
+	{
+	  self->error = TRIO_ERROR_RETURN(TRIO_ERRNO, 0);
+	  break;
+	}
+      self->committed += written;
     }
+  buffer->length = 0;
 }
 
 /*************************************************************************
@@ -3571,6 +4663,28 @@ TRIO_ARGS2((self, output),
   self->committed++;
 }
 
+/*************************************************************************
+ * TrioOutSpanString
+ */
+TRIO_PRIVATE void
+TrioOutSpanString
+TRIO_ARGS3((self, string, length),
+	   trio_class_t *self,
+	   TRIO_CONST char *string,
+	   int length)
+{
+  char **buffer;
+
+  assert(VALID(self));
+  assert(VALID(self->location));
+
+  buffer = (char **)self->location;
+  memcpy(*buffer, string, length);
+  (*buffer) += length;
+  self->processed += length;
+  self->committed += length;
+}
+
 /*************************************************************************
  * TrioOutStreamStringMax
  */
@@ -3596,6 +4710,36 @@ TRIO_ARGS2((self, output),
   self->processed++;
 }
 
+/*************************************************************************
+ * TrioOutSpanStringMax
+ */
+TRIO_PRIVATE void
+TrioOutSpanStringMax
+TRIO_ARGS3((self, string, length),
+	   trio_class_t *self,
+	   TRIO_CONST char *string,
+	   int length)
+{
+  char **buffer;
+  size_t size;
+
+  assert(VALID(self));
+  assert(VALID(self->location));
+
+  buffer = (char **)self->location;
+
+  if (self->processed < self->max)
+    {
+      size = (size_t)(self->max - self->processed);
+      if (size > (size_t)length)
+	size = (size_t)length;
+      memcpy(*buffer, string, size);
+      (*buffer) += size;
+      self->committed += (int)size;
+    }
+  self->processed += length;
+}
+
 /*************************************************************************
  * TrioOutStreamStringDynamic
  */
@@ -3618,6 +4762,29 @@ TRIO_ARGS2((self, output),
   self->processed++;
 }
 
+/*
+ * Output streams of the printf family. Streams with a flush function
+ * have a trio_buffer_t as location.
+ */
+static TRIO_CONST trio_output_t internalOutputFile = {
+  TrioOutStreamBuffered, TrioOutSpanBuffered, TrioOutFlushFile
+};
+static TRIO_CONST trio_output_t internalOutputFileDescriptor = {
+  TrioOutStreamBuffered, TrioOutSpanBuffered, TrioOutFlushFileDescriptor
+};
+static TRIO_CONST trio_output_t internalOutputCustom = {
+  TrioOutStreamCustom, NULL, NULL
+};
+static TRIO_CONST trio_output_t internalOutputString = {
+  TrioOutStreamString, TrioOutSpanString, NULL
+};
+static TRIO_CONST trio_output_t internalOutputStringMax = {
+  TrioOutStreamStringMax, TrioOutSpanStringMax, NULL
+};
+static TRIO_CONST trio_output_t internalOutputStringDynamic = {
+  TrioOutStreamStringDynamic, NULL, NULL
+};
+
 /*************************************************************************
  *
  * Formatted printing functions
@@ -3654,7 +4821,7 @@ TRIO_VARGS2((format, va_alist),
   assert(VALID(format));
 
   TRIO_VA_START(args, format);
-  status = TrioFormat(stdout, 0, TrioOutStreamFile, format, TRIO_VA_LIST_ADDR(args), NULL);
+  status = TrioFormat(stdout, 0, &internalOutputFile, format, TRIO_VA_LIST_ADDR(args), NULL);
   TRIO_VA_END(args);
   return status;
 }
@@ -3674,7 +4841,7 @@ TRIO_ARGS2((format, args),
 {
   assert(VALID(format));
 
-  return TrioFormat(stdout, 0, TrioOutStreamFile, format, TRIO_VA_LIST_ADDR(args), NULL);
+  return TrioFormat(stdout, 0, &internalOutputFile, format, TRIO_VA_LIST_ADDR(args), NULL);
 }
 
 /**
@@ -3692,7 +4859,7 @@ TRIO_ARGS2((format, args),
 {
   assert(VALID(format));
 
-  return TrioFormat(stdout, 0, TrioOutStreamFile, format, NULL, args);
+  return TrioFormat(stdout, 0, &internalOutputFile, format, NULL, args);
 }
 
 /*************************************************************************
@@ -3721,7 +4888,7 @@ TRIO_VARGS3((file, format, va_alist),
   assert(VALID(format));
 
   TRIO_VA_START(args, format);
-  status = TrioFormat(file, 0, TrioOutStreamFile, format, TRIO_VA_LIST_ADDR(args), NULL);
+  status = TrioFormat(file, 0, &internalOutputFile, format, TRIO_VA_LIST_ADDR(args), NULL);
   TRIO_VA_END(args);
   return status;
 }
@@ -3744,7 +4911,7 @@ TRIO_ARGS3((file, format, args),
   assert(VALID(file));
   assert(VALID(format));
 
-  return TrioFormat(file, 0, TrioOutStreamFile, format, TRIO_VA_LIST_ADDR(args), NULL);
+  return TrioFormat(file, 0, &internalOutputFile, format, TRIO_VA_LIST_ADDR(args), NULL);
 }
 
 /**
@@ -3765,7 +4932,7 @@ TRIO_ARGS3((file, format, args),
   assert(VALID(file));
   assert(VALID(format));
 
-  return TrioFormat(file, 0, TrioOutStreamFile, format, NULL, args);
+  return TrioFormat(file, 0, &internalOutputFile, format, NULL, args);
 }
 
 /*************************************************************************
@@ -3793,7 +4960,7 @@ TRIO_VARGS3((fd, format, va_alist),
   assert(VALID(format));
 
   TRIO_VA_START(args, format);
-  status = TrioFormat(&fd, 0, TrioOutStreamFileDescriptor, format, TRIO_VA_LIST_ADDR(args), NULL);
+  status = TrioFormat(&fd, 0, &internalOutputFileDescriptor, format, TRIO_VA_LIST_ADDR(args), NULL);
   TRIO_VA_END(args);
   return status;
 }
@@ -3815,7 +4982,7 @@ TRIO_ARGS3((fd, format, args),
 {
   assert(VALID(format));
 
-  return TrioFormat(&fd, 0, TrioOutStreamFileDescriptor, format, TRIO_VA_LIST_ADDR(args), NULL);
+  return TrioFormat(&fd, 0, &internalOutputFileDescriptor, format, TRIO_VA_LIST_ADDR(args), NULL);
 }
 
 /**
@@ -3835,7 +5002,7 @@ TRIO_ARGS3((fd, format, args),
 {
   assert(VALID(format));
 
-  return TrioFormat(&fd, 0, TrioOutStreamFileDescriptor, format, NULL, args);
+  return TrioFormat(&fd, 0, &internalOutputFileDescriptor, format, NULL, args);
 }
 
 /*************************************************************************
@@ -3859,7 +5026,7 @@ TRIO_VARGS4((stream, closure, format, va_alist),
   TRIO_VA_START(args, format);
   data.stream.out = stream;
   data.closure = closure;
-  status = TrioFormat(&data, 0, TrioOutStreamCustom, format, TRIO_VA_LIST_ADDR(args), NULL);
+  status = TrioFormat(&data, 0, &internalOutputCustom, format, TRIO_VA_LIST_ADDR(args), NULL);
   TRIO_VA_END(args);
   return status;
 }
@@ -3879,7 +5046,7 @@ TRIO_ARGS4((stream, closure, format, args),
 
   data.stream.out = stream;
   data.closure = closure;
-  return TrioFormat(&data, 0, TrioOutStreamCustom, format, TRIO_VA_LIST_ADDR(args), NULL);
+  return TrioFormat(&data, 0, &internalOutputCustom, format, TRIO_VA_LIST_ADDR(args), NULL);
 }
 
 TRIO_PUBLIC int
@@ -3897,7 +5064,7 @@ TRIO_ARGS4((stream, closure, format, args),
 
   data.stream.out = stream;
   data.closure = closure;
-  return TrioFormat(&data, 0, TrioOutStreamCustom, format, NULL, args);
+  return TrioFormat(&data, 0, &internalOutputCustom, format, NULL, args);
 }
 
 /*************************************************************************
@@ -3926,7 +5093,7 @@ TRIO_VARGS3((buffer, format, va_alist),
   assert(VALID(format));
 
   TRIO_VA_START(args, format);
-  status = TrioFormat(&buffer, 0, TrioOutStreamString, format, TRIO_VA_LIST_ADDR(args), NULL);
+  status = TrioFormat(&buffer, 0, &internalOutputString, format, TRIO_VA_LIST_ADDR(args), NULL);
   *buffer = NIL; /* Terminate with NIL character */
   TRIO_VA_END(args);
   return status;
@@ -3952,7 +5119,7 @@ TRIO_ARGS3((buffer, format, args),
   assert(VALID(buffer));
   assert(VALID(format));
 
-  status = TrioFormat(&buffer, 0, TrioOutStreamString, format, TRIO_VA_LIST_ADDR(args), NULL);
+  status = TrioFormat(&buffer, 0, &internalOutputString, format, TRIO_VA_LIST_ADDR(args), NULL);
   *buffer = NIL;
   return status;
 }
@@ -3977,7 +5144,7 @@ TRIO_ARGS3((buffer, format, args),
   assert(VALID(buffer));
   assert(VALID(format));
 
-  status = TrioFormat(&buffer, 0, TrioOutStreamString, format, NULL, args);
+  status = TrioFormat(&buffer, 0, &internalOutputString, format, NULL, args);
   *buffer = NIL;
   return status;
 }
@@ -4011,7 +5178,7 @@ TRIO_VARGS4((buffer, max, format, va_alist),
 
   TRIO_VA_START(args, format);
   status = TrioFormat(&buffer, max > 0 ? max - 1 : 0,
-		      TrioOutStreamStringMax, format, TRIO_VA_LIST_ADDR(args), NULL);
+		      &internalOutputStringMax, format, TRIO_VA_LIST_ADDR(args), NULL);
   if (max > 0)
     *buffer = NIL;
   TRIO_VA_END(args);
@@ -4041,7 +5208,7 @@ TRIO_ARGS4((buffer, max, format, args),
   assert(VALID(format));
 
   status = TrioFormat(&buffer, max > 0 ? max - 1 : 0,
-		      TrioOutStreamStringMax, format, TRIO_VA_LIST_ADDR(args), NULL);
+		      &internalOutputStringMax, format, TRIO_VA_LIST_ADDR(args), NULL);
   if (max > 0)
     *buffer = NIL;
   return status;
@@ -4070,7 +5237,7 @@ TRIO_ARGS4((buffer, max, format, args),
   assert(VALID(format));
 
   status = TrioFormat(&buffer, max > 0 ? max - 1 : 0,
-		      TrioOutStreamStringMax, format, NULL, args);
+		      &internalOutputStringMax, format, NULL, args);
   if (max > 0)
     *buffer = NIL;
   return status;
@@ -4102,7 +5269,7 @@ TRIO_VARGS4((buffer, max, format, va_alist),
   buffer = &buffer[buf_len];
 
   status = TrioFormat(&buffer, max - 1 - buf_len,
-		      TrioOutStreamStringMax, format, TRIO_VA_LIST_ADDR(args), NULL);
+		      &internalOutputStringMax, format, TRIO_VA_LIST_ADDR(args), NULL);
   TRIO_VA_END(args);
   *buffer = NIL;
   return status;
@@ -4125,7 +5292,7 @@ TRIO_ARGS4((buffer, max, format, args),
   buf_len = trio_length(buffer);
   buffer = &buffer[buf_len];
   status = TrioFormat(&buffer, max - 1 - buf_len,
-		      TrioOutStreamStringMax, format, TRIO_VA_LIST_ADDR(args), NULL);
+		      &internalOutputStringMax, format, TRIO_VA_LIST_ADDR(args), NULL);
   *buffer = NIL;
   return status;
 }
@@ -4151,7 +5318,7 @@ TRIO_VARGS2((format, va_alist),
   if (info)
     {
       TRIO_VA_START(args, format);
-      (void)TrioFormat(info, 0, TrioOutStreamStringDynamic,
+      (void)TrioFormat(info, 0, &internalOutputStringDynamic,
 		       format, TRIO_VA_LIST_ADDR(args), NULL);
       TRIO_VA_END(args);
 
@@ -4177,7 +5344,7 @@ TRIO_ARGS2((format, args),
   info = trio_xstring_duplicate("");
   if (info)
     {
-      (void)TrioFormat(info, 0, TrioOutStreamStringDynamic,
+      (void)TrioFormat(info, 0, &internalOutputStringDynamic,
 		       format, TRIO_VA_LIST_ADDR(args), NULL);
       trio_string_terminate(info);
       result = trio_string_extract(info);
@@ -4209,7 +5376,7 @@ TRIO_VARGS3((result, format, va_alist),
   else
     {
       TRIO_VA_START(args, format);
-      status = TrioFormat(info, 0, TrioOutStreamStringDynamic,
+      status = TrioFormat(info, 0, &internalOutputStringDynamic,
 			  format, TRIO_VA_LIST_ADDR(args), NULL);
       TRIO_VA_END(args);
       if (status >= 0)
@@ -4243,7 +5410,7 @@ TRIO_ARGS3((result, format, args),
     }
   else
     {
-      status = TrioFormat(info, 0, TrioOutStreamStringDynamic,
+      status = TrioFormat(info, 0, &internalOutputStringDynamic,
 			  format, TRIO_VA_LIST_ADDR(args), NULL);
       if (status >= 0)
 	{
@@ -4255,6 +5422,123 @@ TRIO_ARGS3((result, format, args),
   return status;
 }
 
+/*************************************************************************
+ * compile
+ */
+
+/**
+   Compile a formatting string.
+
+   The formatting string is parsed once, and can then be printed any
+   number of times with @ref trio_format_compiled, which only has to
+   read the arguments. The formatting string is copied.
+
+   @param format Formatting string.
+   @return Compiled formatting string, or NULL if @p format is invalid
+   or memory is exhausted.
+ */
+TRIO_PUBLIC trio_pointer_t
+trio_compile
+TRIO_ARGS1((format),
+	   TRIO_CONST char *format)
+{
+  trio_parameter_t parameters[MAX_PARAMETERS];
+  int indices[MAX_PARAMETERS];
+  int arguments;
+  int count;
+
+  assert(VALID(format));
+
+  arguments = TrioParseSpecifiers(TYPE_PRINT, format, parameters,
+				  indices, &count);
+  if (arguments < 0)
+    return NULL;
+
+  return (trio_pointer_t)TrioCompile(format, parameters, indices,
+				     arguments, count);
+}
+
+/**
+   Free a compiled formatting string.
+
+   @param compiled Compiled formatting string.
+ */
+TRIO_PUBLIC void
+trio_compiled_free
+TRIO_ARGS1((compiled),
+	   trio_pointer_t compiled)
+{
+  if (compiled)
+    TrioUncompile((trio_compiled_t *)compiled);
+}
+
+/**
+   Print at most @p max characters to string with a compiled formatting
+   string.
+
+   @param buffer Output string.
+   @param max Maximum number of characters to print.
+   @param compiled Compiled formatting string.
+   @param ... Arguments.
+   @return Number of printed characters.
+ */
+TRIO_PUBLIC int
+trio_format_compiled
+TRIO_VARGS4((buffer, max, compiled, va_alist),
+	    char *buffer,
+	    size_t max,
+	    trio_pointer_t compiled,
+	    TRIO_VA_DECL)
+{
+  int status;
+  va_list args;
+
+  assert(VALID(buffer));
+  assert(VALID(compiled));
+
+  TRIO_VA_START(args, compiled);
+  status = TrioFormatCompiled(&buffer, max > 0 ? max - 1 : 0,
+			      &internalOutputStringMax,
+			      (trio_compiled_t *)compiled,
+			      TRIO_VA_LIST_ADDR(args), NULL);
+  TRIO_VA_END(args);
+  if (max > 0)
+    *buffer = NIL;
+  return status;
+}
+
+/**
+   Print at most @p max characters to string with a compiled formatting
+   string.
+
+   @param buffer Output string.
+   @param max Maximum number of characters to print.
+   @param compiled Compiled formatting string.
+   @param args Arguments.
+   @return Number of printed characters.
+ */
+TRIO_PUBLIC int
+trio_vformat_compiled
+TRIO_ARGS4((buffer, max, compiled, args),
+	   char *buffer,
+	   size_t max,
+	   trio_pointer_t compiled,
+	   va_list args)
+{
+  int status;
+
+  assert(VALID(buffer));
+  assert(VALID(compiled));
+
+  status = TrioFormatCompiled(&buffer, max > 0 ? max - 1 : 0,
+			      &internalOutputStringMax,
+			      (trio_compiled_t *)compiled,
+			      TRIO_VA_LIST_ADDR(args), NULL);
+  if (max > 0)
+    *buffer = NIL;
+  return status;
+}
+
 /** @} End of Printf documentation module */
 
 /*************************************************************************
@@ -176,6 +176,8 @@ typedef int SOCKET;
 #define	MAX_CALLBACKS		20
 #define	ARRAY_SIZE(array)	(sizeof(array) / sizeof(array[0]))
 #define	UNKNOWN_CONTENT_LENGTH	((uint64_t) ~0ULL)
+#define	AUTH_SESSION_CACHE_SIZE	64
+#define	AUTH_SESSION_TTL	3600	/* Seconds to trust a response	*/
 #define  MONGOOSE_WEB_ROOT "/mnt/nfs/bin/rstreamer/usr/bin/lighttpd/wwwroot"
 
 #if defined(DEBUG)
@@ -328,10 +330,45 @@ struct callback {
 	char		*uri_regex;	/* URI regex to handle		*/
 	mg_callback_t	func;		/* user callback		*/
 	bool_t		is_auth;	/* func is auth checker		*/
+	bool_t		is_streaming;	/* func reads the request body	*/
 	int		status_code;	/* error code to handle		*/
 	void		*user_data;	/* opaque user data		*/
 };
 
+/*
+ * One line of the passwords file, "user:domain:ha1"
+ */
+struct auth_user {
+	char		*user;		/* User name			*/
+	char		*domain;	/* Authentication domain	*/
+	char		*ha1;		/* MD5(user:domain:password)	*/
+};
+
+/*
+ * Parsed passwords file. It is re-read only when the file modification
+ * time or size changes, so protected requests do not hit the disk.
+ * A file loaded within the second it was modified in is re-read once
+ * more, as it may have been changed again in that second.
+ */
+struct auth_file {
+	struct auth_file *next;		/* Next cached passwords file	*/
+	char		*path;		/* Passwords file name		*/
+	time_t		mtime;		/* Modification time at load	*/
+	uint64_t	size;		/* File size at load		*/
+	time_t		load_time;	/* When the file was read	*/
+	struct auth_user *users;	/* Parsed file lines		*/
+	int		num_users;	/* Number of parsed lines	*/
+};
+
+/*
+ * Digest response that was already verified. A client that re-sends
+ * the same Authorization header is let in without redoing the MD5 work.
+ */
+struct auth_session {
+	char		*key;		/* ha1, request and response	*/
+	time_t		expire_time;	/* When to forget the entry	*/
+};
+
 /*
  * Mongoose context
  */
@@ -356,6 +393,10 @@ struct mg_context {
 	pthread_mutex_t	thr_mutex;
 	pthread_cond_t	thr_cond;
 
+	struct auth_file *auth_files;	/* Cached passwords files	*/
+	struct auth_session auth_sessions[AUTH_SESSION_CACHE_SIZE];
+	pthread_mutex_t	auth_mutex;	/* Protects auth caches		*/
+
 	mg_spcb_t	ssl_password_callback;
 };
 
@@ -371,6 +412,7 @@ struct mg_connection {
 	time_t		birth_time;	/* Time connection was accepted	*/
 	bool_t		free_post_data;	/* post_data was malloc-ed	*/
 	bool_t		keep_alive;	/* Keep-Alive flag		*/
+	bool_t		body_read;	/* Request body was read	*/
 	uint64_t	num_bytes_sent;	/* Total bytes sent to client	*/
 };
 
@@ -642,11 +684,28 @@ find_callback(const struct mg_context *ctx, bool_t is_auth,
 	return (NULL);
 }
 
+/*
+ * Return TRUE if the request body uses chunked transfer coding
+ */
+static bool_t
+is_chunked_request(const struct mg_connection *conn)
+{
+	const char *value = mg_get_header(conn, "Transfer-Encoding");
+	return (value != NULL && !mg_strcasecmp(value, "chunked"));
+}
+
 static bool_t
 does_client_want_keep_alive(const struct mg_connection *conn)
 {
 	const char *value = mg_get_header(conn, "Connection");
 
+	/*
+	 * The end of a chunked body is found only while decoding it, so
+	 * we cannot tell where the next pipelined request starts.
+	 */
+	if (is_chunked_request(conn))
+		return (FALSE);
+
 	/* HTTP/1.1 assumes keep-alive, if Connection header is not set */
 	return ((value == NULL && conn->request_info.http_version_major == 1 &&
 	    conn->request_info.http_version_minor == 1) || (value != NULL &&
@@ -1904,24 +1963,21 @@ check_password(const char *method, const char *ha1, const char *uri,
 /*
  * Use the global passwords file, if specified by auth_gpass option,
  * or search for .htpasswd in the requested directory.
+ * Store the passwords file name in the given buffer.
  */
-static FILE *
-open_auth_file(struct mg_context *ctx, const char *path)
+static void
+get_auth_file_name(struct mg_context *ctx, const char *path,
+		char *name, size_t name_len)
 {
-	char 		name[FILENAME_MAX];
 	const char	*p, *e;
 	struct mgstat	st;
-	FILE		*fp;
 
 	if (ctx->options[OPT_AUTH_GPASSWD] != NULL) {
 		/* Use global passwords file */
-		if ((fp = fopen(ctx->options[OPT_AUTH_GPASSWD], "r")) == NULL)
-			cry(NULL, "fopen(%s): %s",
-			    ctx->options[OPT_AUTH_GPASSWD], strerror(ERRNO));
+		mg_strlcpy(name, ctx->options[OPT_AUTH_GPASSWD], name_len);
 	} else if (!mg_stat(path, &st) && st.is_directory) {
-		(void) mg_snprintf(name, sizeof(name), "%s%c%s",
+		(void) mg_snprintf(name, name_len, "%s%c%s",
 		    path, DIRSEP, PASSWORDS_FILE_NAME);
-		fp = fopen(name, "r");
 	} else {
 		/*
 		 * Try to find .htpasswd in requested directory.
@@ -1939,12 +1995,155 @@ open_auth_file(struct mg_context *ctx, const char *path)
 		 * Make up the path by concatenating directory name and
 		 * .htpasswd file name.
 		 */
-		(void) mg_snprintf(name, sizeof(name), "%.*s%c%s",
+		(void) mg_snprintf(name, name_len, "%.*s%c%s",
 		    (int) (e - p), p, DIRSEP, PASSWORDS_FILE_NAME);
-		fp = fopen(name, "r");
 	}
+}
 
-	return (fp);
+static void
+free_auth_users(struct auth_file *af)
+{
+	int	i;
+
+	for (i = 0; i < af->num_users; i++) {
+		free(af->users[i].user);
+		free(af->users[i].domain);
+		free(af->users[i].ha1);
+	}
+	free(af->users);
+	af->users = NULL;
+	af->num_users = 0;
+}
+
+/*
+ * (Re)load the passwords file into the in-memory credential table.
+ * Return TRUE if the whole file was read. On failure the table is left
+ * empty, a partial one must not be cached.
+ */
+static bool_t
+read_auth_file(struct auth_file *af)
+{
+	FILE		*fp;
+	struct auth_user *users;
+	char		line[256], f_user[256], domain[256], ha1[256];
+	int		size;
+	bool_t		ok = TRUE;
+
+	if ((fp = fopen(af->path, "r")) == NULL)
+		return (FALSE);
+
+	set_close_on_exec(fileno(fp));
+	free_auth_users(af);
+	size = 0;
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+
+		if (sscanf(line, "%[^:]:%[^:]:%s", f_user, domain, ha1) != 3)
+			continue;
+
+		if (af->num_users >= size) {
+			size = size == 0 ? 8 : size * 2;
+			users = (struct auth_user *) realloc(af->users,
+			    size * sizeof(*users));
+			if (users == NULL) {
+				ok = FALSE;
+				break;
+			}
+			af->users = users;
+		}
+
+		users = af->users + af->num_users;
+		users->user = mg_strdup(f_user);
+		users->domain = mg_strdup(domain);
+		users->ha1 = mg_strdup(ha1);
+
+		/* Out of memory: authorize() needs all three */
+		if (users->user == NULL || users->domain == NULL ||
+		    users->ha1 == NULL) {
+			free(users->user);
+			free(users->domain);
+			free(users->ha1);
+			ok = FALSE;
+			break;
+		}
+		af->num_users++;
+	}
+
+	(void) fclose(fp);
+
+	if (!ok)
+		free_auth_users(af);
+
+	return (ok);
+}
+
+/*
+ * Return the credential table for the given passwords file, reloading it
+ * if the file has changed since it was last read. Return NULL if the file
+ * cannot be read. Must be called with ctx->auth_mutex held.
+ */
+static struct auth_file *
+get_auth_file(struct mg_context *ctx, const char *name)
+{
+	struct auth_file	*af;
+	struct mgstat		st;
+
+	if (mg_stat(name, &st) != 0 || st.is_directory)
+		return (NULL);
+
+	for (af = ctx->auth_files; af != NULL; af = af->next)
+		if (!strcmp(af->path, name))
+			break;
+
+	if (af != NULL && af->mtime == st.mtime && af->size == st.size &&
+	    af->load_time > st.mtime)
+		return (af);
+
+	if (af == NULL) {
+		if ((af = (struct auth_file *) calloc(1, sizeof(*af))) == NULL)
+			return (NULL);
+		af->path = mg_strdup(name);
+		af->next = ctx->auth_files;
+		ctx->auth_files = af;
+	}
+
+	if (!read_auth_file(af)) {
+		/* Force the reload on the next request */
+		af->mtime = 0;
+		return (NULL);
+	}
+
+	DEBUG_TRACE("%s: loaded %d users from [%s]\n",
+	    __func__, af->num_users, name);
+	af->mtime = st.mtime;
+	af->size = st.size;
+	af->load_time = time(NULL);
+
+	return (af);
+}
+
+/*
+ * Deallocate cached passwords files and verified sessions
+ */
+static void
+free_auth_cache(struct mg_context *ctx)
+{
+	struct auth_file	*af, *next;
+	int			i;
+
+	for (af = ctx->auth_files; af != NULL; af = next) {
+		next = af->next;
+		free_auth_users(af);
+		free(af->path);
+		free(af);
+	}
+	ctx->auth_files = NULL;
+
+	for (i = 0; i < AUTH_SESSION_CACHE_SIZE; i++)
+		if (ctx->auth_sessions[i].key != NULL) {
+			free(ctx->auth_sessions[i].key);
+			ctx->auth_sessions[i].key = NULL;
+		}
 }
 
 struct ah {
@@ -2009,33 +2208,106 @@ parse_auth_header(struct mg_connection *conn, char *buf, size_t buf_size,
 }
 
 /*
- * Authorize against the opened passwords file. Return 1 if authorized.
+ * Check the password, remembering responses that were verified already.
+ * Everything check_password() hashes is part of the session key, so a
+ * cache hit gives exactly the same answer as recomputing the digest.
  */
 static bool_t
-authorize(struct mg_connection *conn, FILE *fp)
-{
-	struct ah	ah;
-	char		line[256], f_user[256], domain[256], ha1[256],
-			buf[MAX_REQUEST_SIZE];
+check_password_cached(struct mg_context *ctx, const char *method,
+		const char *ha1, const struct ah *ah)
+{
+	struct auth_session	*session;
+	char			*key;
+	const char		*p;
+	unsigned long		hash;
+	time_t			now;
+	size_t			len;
+	bool_t			ok;
+
+	if (ah->uri == NULL || ah->nonce == NULL || ah->nc == NULL ||
+	    ah->cnonce == NULL || ah->qop == NULL || ah->response == NULL)
+		return (check_password(method, ha1, ah->uri, ah->nonce,
+		    ah->nc, ah->cnonce, ah->qop, ah->response));
 
-	if (!parse_auth_header(conn, buf, sizeof(buf), &ah))
-		return (FALSE);
+	/*
+	 * Length-prefix the fields, any of them may contain ':'. The key
+	 * is allocated, authorize() already has a request-sized buffer on
+	 * the stack. 8 fields of up to 10 digits and a ':' each.
+	 */
+	len = strlen(ha1) + strlen(method) + strlen(ah->uri) +
+	    strlen(ah->nonce) + strlen(ah->nc) + strlen(ah->cnonce) +
+	    strlen(ah->qop) + strlen(ah->response) + 8 * 11 + 1;
+	if ((key = (char *) malloc(len)) == NULL)
+		return (check_password(method, ha1, ah->uri, ah->nonce,
+		    ah->nc, ah->cnonce, ah->qop, ah->response));
+	(void) mg_snprintf(key, len,
+	    "%u:%s%u:%s%u:%s%u:%s%u:%s%u:%s%u:%s%u:%s",
+	    (unsigned) strlen(ha1), ha1,
+	    (unsigned) strlen(method), method,
+	    (unsigned) strlen(ah->uri), ah->uri,
+	    (unsigned) strlen(ah->nonce), ah->nonce,
+	    (unsigned) strlen(ah->nc), ah->nc,
+	    (unsigned) strlen(ah->cnonce), ah->cnonce,
+	    (unsigned) strlen(ah->qop), ah->qop,
+	    (unsigned) strlen(ah->response), ah->response);
+
+	for (hash = 0, p = key; *p != '\0'; p++)
+		hash = hash * 31 + * (const unsigned char *) p;
+	session = ctx->auth_sessions + hash % AUTH_SESSION_CACHE_SIZE;
+	now = time(NULL);
+
+	(void) pthread_mutex_lock(&ctx->auth_mutex);
+	ok = session->key != NULL && session->expire_time > now &&
+	    !strcmp(session->key, key);
+	(void) pthread_mutex_unlock(&ctx->auth_mutex);
+
+	if (ok || !check_password(method, ha1, ah->uri, ah->nonce,
+	    ah->nc, ah->cnonce, ah->qop, ah->response)) {
+		free(key);
+		return (ok);
+	}
 
-	/* Loop over passwords file */
-	while (fgets(line, sizeof(line), fp) != NULL) {
+	/* The session takes over the key */
+	(void) pthread_mutex_lock(&ctx->auth_mutex);
+	if (session->key != NULL)
+		free(session->key);
+	session->key = key;
+	session->expire_time = now + AUTH_SESSION_TTL;
+	(void) pthread_mutex_unlock(&ctx->auth_mutex);
 
-		if (sscanf(line, "%[^:]:%[^:]:%s", f_user, domain, ha1) != 3)
-			continue;
+	return (TRUE);
+}
 
-		if (!strcmp(ah.user, f_user) &&
-		    !strcmp(domain, conn->ctx->options[OPT_AUTH_DOMAIN]))
-			return (check_password(
-			    conn->request_info.request_method, ha1,
-			    ah.uri, ah.nonce, ah.nc, ah.cnonce,
-			    ah.qop, ah.response));
-	}
+/*
+ * Authorize against the cached passwords table. Return 1 if authorized.
+ * Called with ctx->auth_mutex held, releases it before the MD5 work.
+ */
+static bool_t
+authorize(struct mg_connection *conn, struct auth_file *af)
+{
+	struct ah	ah;
+	char		ha1[256], buf[MAX_REQUEST_SIZE];
+	const char	*domain;
+	bool_t		found;
+	int		i;
 
-	return (FALSE);
+	found = FALSE;
+	domain = conn->ctx->options[OPT_AUTH_DOMAIN];
+
+	if (parse_auth_header(conn, buf, sizeof(buf), &ah) && ah.user != NULL)
+		for (i = 0; i < af->num_users; i++)
+			if (!strcmp(ah.user, af->users[i].user) &&
+			    !strcmp(domain, af->users[i].domain)) {
+				mg_strlcpy(ha1, af->users[i].ha1, sizeof(ha1));
+				found = TRUE;
+				break;
+			}
+
+	/* The table may be reloaded by other threads once we let it go */
+	(void) pthread_mutex_unlock(&conn->ctx->auth_mutex);
+
+	return (found && check_password_cached(conn->ctx,
+	    conn->request_info.request_method, ha1, &ah));
 }
 
 /*
@@ -2044,14 +2316,14 @@ authorize(struct mg_connection *conn, FILE *fp)
 static bool_t
 check_authorization(struct mg_connection *conn, const char *path)
 {
-	FILE		*fp;
+	struct auth_file *af;
 	size_t		len, n;
-	char		protected_path[FILENAME_MAX];
+	char		name[FILENAME_MAX];
 	const char	*p, *s;
 	const struct callback *cb;
-	bool_t		authorized;
+	bool_t		authorized, is_protected;
 
-	fp = NULL;
+	is_protected = FALSE;
 	authorized = TRUE;
 
 	lock_option(conn->ctx, OPT_PROTECT);
@@ -2065,27 +2337,35 @@ check_authorization(struct mg_connection *conn, const char *path)
 		if (!memcmp(conn->request_info.uri, s, p - s)) {
 
 			n = (size_t) (s + len - p);
-			if (n > sizeof(protected_path) - 1)
-				n = sizeof(protected_path) - 1;
-
-			mg_strlcpy(protected_path, p + 1, n);
+			if (n > sizeof(name) - 1)
+				n = sizeof(name) - 1;
 
-			if ((fp = fopen(protected_path, "r")) == NULL)
-				cry(conn, "%s: cannot open %s: %s",
-				    __func__, protected_path, strerror(errno));
+			mg_strlcpy(name, p + 1, n);
+			is_protected = TRUE;
 			break;
 		}
 	}
 	unlock_option(conn->ctx, OPT_PROTECT);
 
-	if (fp == NULL)
-		fp = open_auth_file(conn->ctx, path);
-
-	if (fp != NULL) {
-		authorized = authorize(conn, fp);
-		(void) fclose(fp);
+	(void) pthread_mutex_lock(&conn->ctx->auth_mutex);
+	af = NULL;
+	if (is_protected && (af = get_auth_file(conn->ctx, name)) == NULL)
+		cry(conn, "%s: cannot open %s: %s",
+		    __func__, name, strerror(errno));
+
+	if (af == NULL) {
+		get_auth_file_name(conn->ctx, path, name, sizeof(name));
+		if ((af = get_auth_file(conn->ctx, name)) == NULL &&
+		    conn->ctx->options[OPT_AUTH_GPASSWD] != NULL)
+			cry(NULL, "fopen(%s): %s", name, strerror(ERRNO));
 	}
 
+	/* authorize() releases the auth mutex */
+	if (af != NULL)
+		authorized = authorize(conn, af);
+	else
+		(void) pthread_mutex_unlock(&conn->ctx->auth_mutex);
+
 	if ((cb = find_callback(conn->ctx, TRUE,
 	    conn->request_info.uri, -1)) != NULL) {
 		struct ah	ah;
@@ -2115,14 +2395,15 @@ send_authorization_request(struct mg_connection *conn)
 static bool_t
 is_authorized_for_put(struct mg_connection *conn)
 {
-	FILE	*fp;
+	struct auth_file *af;
 	int	ret = FALSE;
 
-	if ((fp = fopen(conn->ctx->options[OPT_AUTH_PUT], "r")) != NULL) {
-		set_close_on_exec(fileno(fp));
-		ret = authorize(conn, fp);
-		(void) fclose(fp);
-	}
+	(void) pthread_mutex_lock(&conn->ctx->auth_mutex);
+	if ((af = get_auth_file(conn->ctx,
+	    conn->ctx->options[OPT_AUTH_PUT])) != NULL)
+		ret = authorize(conn, af);
+	else
+		(void) pthread_mutex_unlock(&conn->ctx->auth_mutex);
 
 	return (ret);
 }
@@ -2462,7 +2743,8 @@ substitute_index_file(struct mg_connection *conn,
 
 static void
 mg_bind(struct mg_context *ctx, const char *uri_regex, int status_code,
-		mg_callback_t func, bool_t is_auth, void *user_data)
+		mg_callback_t func, bool_t is_auth, bool_t is_streaming,
+		void *user_data)
 {
 	struct callback	*cb;
 
@@ -2473,6 +2755,7 @@ mg_bind(struct mg_context *ctx, const char *uri_regex, int status_code,
 		cb->uri_regex = uri_regex ? mg_strdup(uri_regex) : NULL;
 		cb->func = func;
 		cb->is_auth = is_auth;
+		cb->is_streaming = is_streaming;
 		cb->status_code = status_code;
 		cb->user_data = user_data;
 		ctx->num_callbacks++;
@@ -2487,7 +2770,21 @@ mg_bind_to_uri(struct mg_context *ctx, const char *uri_regex,
 {
 	assert(func != NULL);
 	assert(uri_regex != NULL);
-	mg_bind(ctx, uri_regex, -1, func, FALSE, user_data);
+	mg_bind(ctx, uri_regex, -1, func, FALSE, FALSE, user_data);
+}
+
+/*
+ * Same as mg_bind_to_uri(), but POST and PUT bodies are not buffered
+ * before the callback is called. The callback reads the body itself
+ * with mg_read_body().
+ */
+void
+mg_bind_to_uri_streaming(struct mg_context *ctx, const char *uri_regex,
+		mg_callback_t func, void *user_data)
+{
+	assert(func != NULL);
+	assert(uri_regex != NULL);
+	mg_bind(ctx, uri_regex, -1, func, FALSE, TRUE, user_data);
 }
 
 void
@@ -2496,7 +2793,7 @@ mg_bind_to_error_code(struct mg_context *ctx, int error_code,
 {
 	assert(error_code >= 0 && error_code < 1000);
 	assert(func != NULL);
-	mg_bind(ctx, NULL, error_code, func, FALSE, user_data);
+	mg_bind(ctx, NULL, error_code, func, FALSE, FALSE, user_data);
 }
 
 void
@@ -2505,7 +2802,7 @@ mg_protect_uri(struct mg_context *ctx, const char *uri_regex,
 {
 	assert(func != NULL);
 	assert(uri_regex != NULL);
-	mg_bind(ctx, uri_regex, -1, func, TRUE, user_data);
+	mg_bind(ctx, uri_regex, -1, func, TRUE, FALSE, user_data);
 }
 
 static int
@@ -2515,39 +2812,191 @@ not_modified(const struct mg_connection *conn, const struct mgstat *stp)
 	return (ims != NULL && stp->mtime < date_to_epoch(ims));
 }
 
-static bool_t
-append_chunk(struct mg_request_info *ri, int fd, const char *buf, int len)
-{
-	bool_t	ret_code = TRUE;
-
-	if (fd == -1) {
-		/* TODO: check for NULL here */
-		ri->post_data = (char *) realloc(ri->post_data,
-		    ri->post_data_len + len);
-		(void) memcpy(ri->post_data + ri->post_data_len, buf, len);
-		ri->post_data_len += len;
-	} else if (push(fd, INVALID_SOCKET,
-	    NULL, buf, (uint64_t) len) != (uint64_t) len) {
-		ret_code = FALSE;
+/*
+ * Request body consumer. Gets successive slices of the body as they
+ * arrive, must return non-zero to continue or 0 to abort the transfer.
+ */
+typedef int (*mg_body_func_t)(struct mg_connection *,
+		const char *buf, int len, void *user_data);
+
+/*
+ * Chunked transfer coding decoder states, RFC 2616 section 3.6.1
+ */
+enum {
+	CHUNK_SIZE, CHUNK_EXTENSION, CHUNK_SIZE_LF, CHUNK_DATA, CHUNK_DATA_CR,
+	CHUNK_DATA_LF, CHUNK_TRAILER, CHUNK_TRAILER_LINE, CHUNK_TRAILER_LF,
+	CHUNK_DONE, CHUNK_ERROR
+};
+
+struct chunk_decoder {
+	int		state;		/* One of CHUNK_* values	*/
+	int		num_digits;	/* Chunk size digits seen	*/
+	uint64_t	remaining;	/* Bytes left in current chunk	*/
+};
+
+/*
+ * Decode the next piece of a chunked body. Chunk data is passed to the
+ * consumer in place, without copying. Return number of bytes consumed.
+ */
+static int
+decode_chunks(struct mg_connection *conn, struct chunk_decoder *cd,
+		const char *buf, int len, mg_body_func_t func, void *user_data)
+{
+	int	i, n, c;
+
+	for (i = 0; i < len &&
+	    cd->state != CHUNK_DONE && cd->state != CHUNK_ERROR; i++) {
+		c = ((const unsigned char *) buf)[i];
+
+		switch (cd->state) {
+		case CHUNK_SIZE:
+			if (isxdigit(c)) {
+				if (cd->remaining > (UNKNOWN_CONTENT_LENGTH >> 4)) {
+					cd->state = CHUNK_ERROR;
+					break;
+				}
+				cd->remaining = cd->remaining * 16 +
+				    (isdigit(c) ? c - '0' : tolower(c) - 'a' + 10);
+				cd->num_digits++;
+				break;
+			} else if (cd->num_digits == 0) {
+				cd->state = CHUNK_ERROR;
+				break;
+			}
+			cd->state = CHUNK_EXTENSION;
+			/* FALLTHROUGH */
+		case CHUNK_EXTENSION:
+			if (c == '\r')
+				cd->state = CHUNK_SIZE_LF;
+			else if (c == '\n')
+				cd->state = cd->remaining ? CHUNK_DATA : CHUNK_TRAILER;
+			break;
+		case CHUNK_SIZE_LF:
+			if (c != '\n')
+				cd->state = CHUNK_ERROR;
+			else
+				cd->state = cd->remaining ? CHUNK_DATA : CHUNK_TRAILER;
+			break;
+		case CHUNK_DATA:
+			n = len - i;
+			if ((uint64_t) n > cd->remaining)
+				n = (int) cd->remaining;
+			if (!func(conn, buf + i, n, user_data)) {
+				cd->state = CHUNK_ERROR;
+				break;
+			}
+			cd->remaining -= n;
+			i += n - 1;
+			if (cd->remaining == 0)
+				cd->state = CHUNK_DATA_CR;
+			break;
+		case CHUNK_DATA_CR:
+			if (c == '\r') {
+				cd->state = CHUNK_DATA_LF;
+				break;
+			}
+			/* FALLTHROUGH */
+		case CHUNK_DATA_LF:
+			if (c == '\n') {
+				cd->state = CHUNK_SIZE;
+				cd->num_digits = 0;
+			} else {
+				cd->state = CHUNK_ERROR;
+			}
+			break;
+		case CHUNK_TRAILER:
+			if (c == '\r')
+				cd->state = CHUNK_TRAILER_LF;
+			else if (c == '\n')
+				cd->state = CHUNK_DONE;
+			else
+				cd->state = CHUNK_TRAILER_LINE;
+			break;
+		case CHUNK_TRAILER_LINE:
+			if (c == '\n')
+				cd->state = CHUNK_TRAILER;
+			break;
+		case CHUNK_TRAILER_LF:
+			cd->state = c == '\n' ? CHUNK_DONE : CHUNK_ERROR;
+			break;
+		}
 	}
 
-	return (ret_code);
+	return (i);
 }
 
+/*
+ * Pass the request body to the consumer as it arrives: first the part
+ * that was read together with the request headers, then the rest
+ * straight from the socket buffer. Return TRUE if the whole body
+ * was consumed.
+ */
 static bool_t
-handle_request_body(struct mg_connection *conn, int fd)
+read_body(struct mg_connection *conn, mg_body_func_t func, void *user_data)
 {
 	struct mg_request_info	*ri = &conn->request_info;
-	const char	*expect, *tmp;
-	uint64_t	content_len;
-	char		buf[BUFSIZ];
-	int		to_read, nread, already_read;
-	bool_t		success_code = FALSE;
+	struct chunk_decoder	cd;
+	uint64_t		content_len;
+	char			buf[BUFSIZ];
+	int			to_read, nread;
+
+	conn->body_read = TRUE;
+
+	if (is_chunked_request(conn)) {
+		(void) memset(&cd, 0, sizeof(cd));
+		(void) decode_chunks(conn, &cd, ri->post_data,
+		    ri->post_data_len, func, user_data);
+
+		while (cd.state != CHUNK_DONE && cd.state != CHUNK_ERROR) {
+			nread = pull(-1, conn->client.sock,
+			    conn->ssl, buf, sizeof(buf));
+			if (nread <= 0)
+				break;
+			(void) decode_chunks(conn, &cd, buf, nread,
+			    func, user_data);
+		}
+
+		return (cd.state == CHUNK_DONE ? TRUE : FALSE);
+	}
 
 	content_len = get_content_length(conn);
+	assert(ri->post_data_len >= 0);
+
+	nread = ri->post_data_len;
+	if ((uint64_t) nread > content_len)
+		nread = (int) content_len;
+	if (nread > 0 && !func(conn, ri->post_data, nread, user_data))
+		return (FALSE);
+	content_len -= nread;
+
+	while (content_len > 0) {
+		to_read = sizeof(buf);
+		if ((uint64_t) to_read > content_len)
+			to_read = (int) content_len;
+		nread = pull(-1, conn->client.sock, conn->ssl, buf, to_read);
+		if (nread <= 0 || !func(conn, buf, nread, user_data))
+			break;
+		content_len -= nread;
+	}
+
+	return (content_len == 0 ? TRUE : FALSE);
+}
+
+/*
+ * Check request body headers and read the body. Each error code path
+ * in this function must send an error.
+ */
+static bool_t
+stream_request_body(struct mg_connection *conn, mg_body_func_t func,
+		void *user_data)
+{
+	const char	*expect;
+	bool_t		success_code = FALSE;
+
 	expect = mg_get_header(conn, "Expect");
 
-	if (content_len == UNKNOWN_CONTENT_LENGTH) {
+	if (get_content_length(conn) == UNKNOWN_CONTENT_LENGTH &&
+	    !is_chunked_request(conn)) {
 		send_error(conn, 411, "Length Required", "");
 	} else if (expect != NULL && mg_strcasecmp(expect, "100-continue")) {
 		send_error(conn, 417, "Expectation Failed", "");
@@ -2555,57 +3004,152 @@ handle_request_body(struct mg_connection *conn, int fd)
 		if (expect != NULL)
 			(void) mg_printf(conn, "HTTP/1.1 100 Continue\r\n\r\n");
 
-		already_read = ri->post_data_len;
-		assert(already_read >= 0);
+		success_code = read_body(conn, func, user_data);
 
-		if (content_len <= (uint64_t) already_read) {
-			ri->post_data_len = (int) content_len;
-			/*
-			 * If fd == -1, this is embedded mode, and we do not
-			 * have to do anything: POST data is already there,
-			 * no need to allocate a buffer and copy it in.
-			 * If fd != -1, we need to write the data.
-			 */
-			success_code = (fd == -1) || (push(fd, INVALID_SOCKET,
-			    NULL, ri->post_data, content_len) == content_len) ?
-			    TRUE : FALSE;
-		} else {
+		/* The rest of the body is unread, so is the next request */
+		if (success_code != TRUE) {
+			send_error(conn, 577, http_500_error,
+			   "%s", "Error handling body data");
+			conn->keep_alive = FALSE;
+		}
+	}
 
-			if (fd == -1) {
-				conn->free_post_data = TRUE;
-				tmp = ri->post_data;
-				/* +1 in case if already_read == 0 */
-				ri->post_data = (char*)malloc(already_read + 1);
-				(void) memcpy(ri->post_data, tmp, already_read);
-			} else {
-				(void) push(fd, INVALID_SOCKET, NULL,
-				    ri->post_data, (uint64_t) already_read);
-			}
+	return (success_code);
+}
 
-			content_len -= already_read;
+/*
+ * Read the request body, passing it to the consumer function piece by
+ * piece. Return 1 if the whole body was read. Otherwise, the error
+ * response has already been sent to the client.
+ */
+int
+mg_read_body(struct mg_connection *conn, mg_body_func_t func, void *user_data)
+{
+	assert(func != NULL);
+	return (stream_request_body(conn, func, user_data));
+}
 
-			while (content_len > 0) {
-				to_read = sizeof(buf);
-				if ((uint64_t) to_read > content_len)
-					to_read = (int) content_len;
-				nread = pull(-1, conn->client.sock,
-				    conn->ssl, buf, to_read);
-				if (nread <= 0)
-					break;
-				if (!append_chunk(ri, fd, buf, nread))
-					break;
-				content_len -= nread;
-			}
-			success_code = content_len == 0 ? TRUE : FALSE;
-		}
+static int
+discard_chunk(struct mg_connection *conn, const char *buf, int len,
+		void *user_data)
+{
+	(void) conn;
+	(void) buf;
+	(void) len;
+	(void) user_data;
 
-		/* Each error code path in this function must send an error */
-		if (success_code != TRUE)
-			send_error(conn, 577, http_500_error,
-			   "%s", "Error handling body data");
+	return (1);
+}
+
+/*
+ * Skip the body of a request that was handled without reading it, so
+ * it is not taken for the next request on the connection. Large and
+ * chunked bodies are not worth reading: close the connection instead.
+ */
+static void
+discard_request_body(struct mg_connection *conn)
+{
+	uint64_t	content_len;
+
+	content_len = get_content_length(conn);
+	if (conn->body_read ||
+	    (content_len == UNKNOWN_CONTENT_LENGTH &&
+	    !is_chunked_request(conn)))
+		return;
+
+	if (is_chunked_request(conn) || content_len > MAX_REQUEST_SIZE ||
+	    !read_body(conn, discard_chunk, NULL))
+		conn->keep_alive = FALSE;
+}
+
+/*
+ * Request body collected in memory for the embedded callbacks
+ */
+struct body_buffer {
+	const char	*pre_read;	/* Body read with the headers	*/
+	int		pre_read_len;
+	char		*data;		/* Body collected so far	*/
+	int		len;		/* Collected length		*/
+	int		size;		/* Allocated size, 0 if borrowed*/
+};
+
+static int
+append_chunk(struct mg_connection *conn, const char *buf, int len,
+		void *user_data)
+{
+	struct body_buffer	*bb = (struct body_buffer *) user_data;
+	char			*p;
+	int			size;
+
+	/*
+	 * If the first slice lies in the request buffer, just point to it.
+	 * Most small bodies come in one piece with the request headers.
+	 */
+	if (bb->len == 0 && buf >= bb->pre_read &&
+	    buf + len <= bb->pre_read + bb->pre_read_len) {
+		bb->data = (char *) buf;
+		bb->len = len;
+		return (TRUE);
 	}
 
-	return (success_code);
+	if (len > INT_MAX / 2 - bb->len)
+		return (FALSE);
+
+	if (bb->len + len > bb->size) {
+		for (size = bb->size ? bb->size : BUFSIZ;
+		    size < bb->len + len; size *= 2)
+			;
+		if ((p = (char *) malloc(size)) == NULL)
+			return (FALSE);
+		(void) memcpy(p, bb->data, bb->len);
+		if (bb->size > 0)
+			free(bb->data);
+		bb->data = p;
+		bb->size = size;
+	}
+
+	(void) memcpy(bb->data + bb->len, buf, len);
+	bb->len += len;
+
+	return (TRUE);
+}
+
+static int
+write_chunk(struct mg_connection *conn, const char *buf, int len,
+		void *user_data)
+{
+	return (push(* (int *) user_data, INVALID_SOCKET, NULL,
+	    buf, (uint64_t) len) == (uint64_t) len);
+}
+
+/*
+ * Read the request body into the opened file descriptor, or, if fd is -1,
+ * into ri->post_data for the embedded callbacks.
+ */
+static bool_t
+handle_request_body(struct mg_connection *conn, int fd)
+{
+	struct mg_request_info	*ri = &conn->request_info;
+	struct body_buffer	bb;
+
+	if (fd != -1)
+		return (stream_request_body(conn, write_chunk, &fd));
+
+	(void) memset(&bb, 0, sizeof(bb));
+	bb.pre_read = ri->post_data;
+	bb.pre_read_len = ri->post_data_len;
+
+	if (!stream_request_body(conn, append_chunk, &bb)) {
+		if (bb.size > 0)
+			free(bb.data);
+		return (FALSE);
+	}
+
+	ri->post_data = bb.len > 0 ? bb.data : ri->post_data;
+	ri->post_data_len = bb.len;
+	conn->free_post_data = bb.size > 0 ? TRUE : FALSE;
+
+	return (TRUE);
 }
 
 #if !defined(NO_CGI)
@@ -3089,10 +3633,12 @@ analyze_request(struct mg_connection *conn)
 	} else
 #endif /* !NO_AUTH */
 	if ((cb = find_callback(conn->ctx, FALSE, uri, -1)) != NULL) {
-		if ((strcmp(ri->request_method, "POST") != 0 &&
+		if (cb->is_streaming ||
+		    (strcmp(ri->request_method, "POST") != 0 &&
 		    strcmp(ri->request_method, "PUT") != 0) ||
 		    handle_request_body(conn, -1))
 			cb->func(conn, &conn->request_info, cb->user_data);
+		discard_request_body(conn);
 	} else
 #if !defined(NO_AUTH)
 	if (strstr(path, PASSWORDS_FILE_NAME)) {
@@ -3348,6 +3894,11 @@ mg_fini(struct mg_context *ctx)
 	(void) pthread_mutex_destroy(&ctx->thr_mutex);
 	(void) pthread_cond_destroy(&ctx->thr_cond);
 
+#if !defined(NO_AUTH)
+	free_auth_cache(ctx);
+#endif /* !NO_AUTH */
+	(void) pthread_mutex_destroy(&ctx->auth_mutex);
+
 	/* Signal mg_stop() that we're done */
 	ctx->stop_flag = 2;
 }
@@ -3789,6 +4340,7 @@ reset_connection_attributes(struct mg_connection *conn)
 	conn->free_post_data = FALSE;
 	conn->request_info.status_code = -1;
 	conn->keep_alive = FALSE;
+	conn->body_read = FALSE;
 	conn->num_bytes_sent = 0;
 	(void) memset(&conn->request_info, 0, sizeof(conn->request_info));
 }
@@ -4110,6 +4662,7 @@ mg_start(void)
 
 	(void) pthread_mutex_init(&ctx->thr_mutex, NULL);
 	(void) pthread_cond_init(&ctx->thr_cond, NULL);
+	(void) pthread_mutex_init(&ctx->auth_mutex, NULL);
 
 	/* Start master (listening) thread */
 	start_thread((mg_thread_func_t) master_thread, ctx);
@@ -72,6 +72,18 @@ struct wl_socket {
 	char *display_name;
 };
 
+/* Recently used objects of a client, indexed by the low bits of their id.
+ * Requests tend to come in runs on the same few objects, like attach,
+ * damage and commit on a surface.  An entry is dropped whenever its id is
+ * reused or removed in the object map; an id of 0 marks it unused. */
+#define WL_CLIENT_LOOKUP_CACHE_SIZE 8
+
+struct wl_object_lookup {
+	uint32_t id;
+	uint32_t flags;
+	struct wl_resource *resource;
+};
+
 struct wl_client {
 	struct wl_connection *connection;
 	struct wl_event_source *source;
@@ -84,6 +96,7 @@ struct wl_client {
 	struct wl_signal destroy_signal;
 	struct ucred ucred;
 	int error;
+	struct wl_object_lookup lookup_cache[WL_CLIENT_LOOKUP_CACHE_SIZE];
 };
 
 struct wl_display {
@@ -233,6 +246,33 @@ wl_resource_post_error(struct wl_resource *resource,
 			       WL_DISPLAY_ERROR, resource, code, buffer);
 }
 
+static struct wl_resource *
+wl_client_lookup_object(struct wl_client *client, uint32_t id,
+			uint32_t *flags)
+{
+	struct wl_object_lookup *entry =
+		&client->lookup_cache[id & (WL_CLIENT_LOOKUP_CACHE_SIZE - 1)];
+
+	if (id == 0 || entry->id != id) {
+		entry->resource = wl_map_lookup(&client->objects, id);
+		entry->flags = wl_map_lookup_flags(&client->objects, id);
+		entry->id = entry->resource ? id : 0;
+	}
+
+	*flags = entry->flags;
+	return entry->resource;
+}
+
+static void
+wl_client_forget_object(struct wl_client *client, uint32_t id)
+{
+	struct wl_object_lookup *entry =
+		&client->lookup_cache[id & (WL_CLIENT_LOOKUP_CACHE_SIZE - 1)];
+
+	if (entry->id == id)
+		entry->id = 0;
+}
+
 static int
 wl_client_connection_data(int fd, uint32_t mask, void *data)
 {
@@ -279,8 +319,8 @@ wl_client_connection_data(int fd, uint32_t mask, void *data)
 		if (len < size)
 			break;
 
-		resource = wl_map_lookup(&client->objects, p[0]);
-		resource_flags = wl_map_lookup_flags(&client->objects, p[0]);
+		resource = wl_client_lookup_object(client, p[0],
+						   &resource_flags);
 		if (resource == NULL) {
 			wl_resource_post_error(client->display_resource,
 					       WL_DISPLAY_ERROR_INVALID_OBJECT,
@@ -595,6 +635,7 @@ wl_resource_destroy(struct wl_resource *resource)
 	} else {
 		wl_map_remove(&client->objects, id);
 	}
+	wl_client_forget_object(client, id);
 }
 
 WL_EXPORT uint32_t
@@ -1435,6 +1476,7 @@ wl_resource_create(struct wl_client *client,
 		free(resource);
 		return NULL;
 	}
+	wl_client_forget_object(client, id);
 
 	return resource;
 }
@@ -1519,6 +1561,7 @@ wl_client_add_resource(struct wl_client *client,
 				       resource->object.id);
 		return 0;
 	}
+	wl_client_forget_object(client, resource->object.id);
 
 	resource->client = client;
 	wl_signal_init(&resource->destroy_signal);
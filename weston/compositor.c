@@ -71,6 +71,57 @@ weston_output_transform_scale_init(struct weston_output *output,
 static void
 weston_compositor_build_view_list(struct weston_compositor *compositor);
 
+/* compositor->view_list only needs rebuilding when a view enters or leaves
+ * a layer, a sub-surface is added, removed, restacked, mapped or unmapped,
+ * or the layer list itself changes.  The first cases mark the list dirty
+ * where they happen.  Shells reorder layer_list directly, so that is
+ * caught by comparing it against the layers seen by the last build.
+ */
+#define VIEW_LIST_MAX_LAYERS 32
+
+static struct {
+	bool dirty;
+	int num_layers;		/* -1 if there were too many to track */
+	struct weston_layer *layers[VIEW_LIST_MAX_LAYERS];
+} view_list_state = { true };
+
+static void
+view_list_set_dirty(void)
+{
+	view_list_state.dirty = true;
+}
+
+/* Index for weston_compositor_pick_view.  Each output is split into a
+ * PICK_GRID_DIM x PICK_GRID_DIM grid, and each cell lists the views whose
+ * bounding box overlaps it, in view list order.  Anything that changes a
+ * bounding box or the view list bumps the generation, and a grid is
+ * rebuilt on the next pick that lands on its output.  Grids are indexed
+ * by output id.
+ */
+#define PICK_GRID_DIM 16
+#define PICK_GRID_CELLS (PICK_GRID_DIM * PICK_GRID_DIM)
+
+struct pick_grid {
+	uint32_t generation;
+	bool valid;
+	int x, y, width, height;
+	int cell_width, cell_height;
+	uint32_t start[PICK_GRID_CELLS + 1];
+	struct weston_view **views;
+	uint32_t size;
+};
+
+static struct {
+	uint32_t generation;
+	struct pick_grid grids[32];
+} pick_index = { 1 };
+
+static void
+pick_index_invalidate(void)
+{
+	pick_index.generation++;
+}
+
 static void weston_mode_switch_finish(struct weston_output *output,
 				      int mode_changed,
 				      int scale_changed)
@@ -728,6 +779,104 @@ weston_transformed_rect(int width, int height,
 	return ret;
 }
 
+/* Whether transforming a point with z = 0 and w = 1 by the matrix leaves
+ * w at 1, so that no division is needed.
+ */
+static bool
+matrix_is_affine_2d(const struct weston_matrix *matrix)
+{
+	return matrix->d[3] == 0.0f && matrix->d[7] == 0.0f &&
+	       matrix->d[15] == 1.0f;
+}
+
+/* Whether the matrix moves points in the z = 0 plane by whole pixels only */
+static bool
+matrix_is_integer_translate(const struct weston_matrix *matrix)
+{
+	float tx = matrix->d[12];
+	float ty = matrix->d[13];
+
+	return matrix_is_affine_2d(matrix) &&
+	       matrix->d[0] == 1.0f && matrix->d[1] == 0.0f &&
+	       matrix->d[4] == 0.0f && matrix->d[5] == 1.0f &&
+	       tx == floorf(tx) && ty == floorf(ty) &&
+	       fabsf(tx) < (1 << 24) && fabsf(ty) < (1 << 24);
+}
+
+/* Transform n points in the z = 0 plane by an affine matrix, see
+ * matrix_is_affine_2d().  The sums are done in the same order as in
+ * weston_matrix_transform(), so the results are the same, but a plain
+ * loop over separate coordinate arrays lets the compiler vectorize it.
+ */
+static void
+matrix_transform_points_2d(const struct weston_matrix *matrix,
+			   const float *x, const float *y,
+			   float *tx, float *ty, int n)
+{
+	const float m0 = matrix->d[0], m1 = matrix->d[1];
+	const float m4 = matrix->d[4], m5 = matrix->d[5];
+	const float m12 = matrix->d[12], m13 = matrix->d[13];
+	int i;
+
+	for (i = 0; i < n; i++) {
+		tx[i] = x[i] * m0 + y[i] * m4 + m12;
+		ty[i] = x[i] * m1 + y[i] * m5 + m13;
+	}
+}
+
+static void
+box_from_corners(pixman_box32_t *box, float x1, float y1, float x2, float y2)
+{
+	if (x1 < x2) {
+		box->x1 = floor(x1);
+		box->x2 = ceil(x2);
+	} else {
+		box->x1 = floor(x2);
+		box->x2 = ceil(x1);
+	}
+
+	if (y1 < y2) {
+		box->y1 = floor(y1);
+		box->y2 = ceil(y2);
+	} else {
+		box->y1 = floor(y2);
+		box->y2 = ceil(y1);
+	}
+}
+
+/* Transform the corners of all rectangles in one pass */
+static bool
+matrix_transform_rects_2d(const struct weston_matrix *matrix,
+			  const pixman_box32_t *src_rects,
+			  pixman_box32_t *dest_rects, int nrects)
+{
+	float *x, *y, *tx, *ty;
+	int i, n = 2 * nrects;
+
+	x = malloc(4 * n * sizeof *x);
+	if (!x)
+		return false;
+	y = x + n;
+	tx = y + n;
+	ty = tx + n;
+
+	for (i = 0; i < nrects; i++) {
+		x[2 * i] = src_rects[i].x1;
+		y[2 * i] = src_rects[i].y1;
+		x[2 * i + 1] = src_rects[i].x2;
+		y[2 * i + 1] = src_rects[i].y2;
+	}
+
+	matrix_transform_points_2d(matrix, x, y, tx, ty, n);
+
+	for (i = 0; i < nrects; i++)
+		box_from_corners(&dest_rects[i], tx[2 * i], ty[2 * i],
+				 tx[2 * i + 1], ty[2 * i + 1]);
+
+	free(x);
+	return true;
+}
+
 /** Transform a region by a matrix, restricted to axis-aligned transformations
  *
  * Warning: This function does not work for projective, affine, or matrices
@@ -742,40 +891,36 @@ weston_matrix_transform_region(pixman_region32_t *dest,
 	pixman_box32_t *src_rects, *dest_rects;
 	int nrects, i;
 
+	if (matrix_is_integer_translate(matrix)) {
+		pixman_region32_copy(dest, src);
+		pixman_region32_translate(dest, matrix->d[12], matrix->d[13]);
+		return;
+	}
+
 	src_rects = pixman_region32_rectangles(src, &nrects);
 	dest_rects = malloc(nrects * sizeof(*dest_rects));
 	if (!dest_rects)
 		return;
 
-	for (i = 0; i < nrects; i++) {
-		struct weston_vector vec1 = {{
-			src_rects[i].x1, src_rects[i].y1, 0, 1
-		}};
-		weston_matrix_transform(matrix, &vec1);
-		vec1.f[0] /= vec1.f[3];
-		vec1.f[1] /= vec1.f[3];
-
-		struct weston_vector vec2 = {{
-			src_rects[i].x2, src_rects[i].y2, 0, 1
-		}};
-		weston_matrix_transform(matrix, &vec2);
-		vec2.f[0] /= vec2.f[3];
-		vec2.f[1] /= vec2.f[3];
-
-		if (vec1.f[0] < vec2.f[0]) {
-			dest_rects[i].x1 = floor(vec1.f[0]);
-			dest_rects[i].x2 = ceil(vec2.f[0]);
-		} else {
-			dest_rects[i].x1 = floor(vec2.f[0]);
-			dest_rects[i].x2 = ceil(vec1.f[0]);
-		}
-
-		if (vec1.f[1] < vec2.f[1]) {
-			dest_rects[i].y1 = floor(vec1.f[1]);
-			dest_rects[i].y2 = ceil(vec2.f[1]);
-		} else {
-			dest_rects[i].y1 = floor(vec2.f[1]);
-			dest_rects[i].y2 = ceil(vec1.f[1]);
+	if (!matrix_is_affine_2d(matrix) ||
+	    !matrix_transform_rects_2d(matrix, src_rects, dest_rects, nrects)) {
+		for (i = 0; i < nrects; i++) {
+			struct weston_vector vec1 = {{
+				src_rects[i].x1, src_rects[i].y1, 0, 1
+			}};
+			weston_matrix_transform(matrix, &vec1);
+			vec1.f[0] /= vec1.f[3];
+			vec1.f[1] /= vec1.f[3];
+
+			struct weston_vector vec2 = {{
+				src_rects[i].x2, src_rects[i].y2, 0, 1
+			}};
+			weston_matrix_transform(matrix, &vec2);
+			vec2.f[0] /= vec2.f[3];
+			vec2.f[1] /= vec2.f[3];
+
+			box_from_corners(&dest_rects[i], vec1.f[0], vec1.f[1],
+					 vec2.f[0], vec2.f[1]);
 		}
 	}
 
@@ -1125,6 +1270,8 @@ weston_surface_assign_output(struct weston_surface *es)
 	}
 	pixman_region32_fini(&region);
 
+	if (!es->output != !new_output)
+		view_list_set_dirty();
 	es->output = new_output;
 	weston_surface_update_output_mask(es, mask);
 }
@@ -1228,17 +1375,41 @@ view_compute_bbox(struct weston_view *view, const pixman_box32_t *inbox,
 		return;
 	}
 
-	for (i = 0; i < 4; ++i) {
-		float x, y;
-		weston_view_to_global_float(view, s[i][0], s[i][1], &x, &y);
-		if (x < min_x)
-			min_x = x;
-		if (x > max_x)
-			max_x = x;
-		if (y < min_y)
-			min_y = y;
-		if (y > max_y)
-			max_y = y;
+	if (view->transform.enabled &&
+	    matrix_is_affine_2d(&view->transform.matrix)) {
+		float x[4], y[4], tx[4], ty[4];
+
+		for (i = 0; i < 4; ++i) {
+			x[i] = s[i][0];
+			y[i] = s[i][1];
+		}
+		matrix_transform_points_2d(&view->transform.matrix,
+					   x, y, tx, ty, 4);
+
+		for (i = 0; i < 4; ++i) {
+			if (tx[i] < min_x)
+				min_x = tx[i];
+			if (tx[i] > max_x)
+				max_x = tx[i];
+			if (ty[i] < min_y)
+				min_y = ty[i];
+			if (ty[i] > max_y)
+				max_y = ty[i];
+		}
+	} else {
+		for (i = 0; i < 4; ++i) {
+			float x, y;
+			weston_view_to_global_float(view, s[i][0], s[i][1],
+						    &x, &y);
+			if (x < min_x)
+				min_x = x;
+			if (x > max_x)
+				max_x = x;
+			if (y < min_y)
+				min_y = y;
+			if (y > max_y)
+				max_y = y;
+		}
 	}
 
 	int_x = floorf(min_x);
@@ -1354,6 +1525,7 @@ weston_view_update_transform(struct weston_view *view)
 		weston_view_update_transform(parent);
 
 	view->transform.dirty = 0;
+	pick_index_invalidate();
 
 	weston_view_damage_below(view);
 
@@ -1805,38 +1977,174 @@ weston_compositor_get_time(void)
        return tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
 
-WL_EXPORT struct weston_view *
-weston_compositor_pick_view(struct weston_compositor *compositor,
-			    wl_fixed_t x, wl_fixed_t y,
-			    wl_fixed_t *vx, wl_fixed_t *vy)
+static bool
+weston_view_accepts_input_at(struct weston_view *view,
+			     wl_fixed_t x, wl_fixed_t y,
+			     wl_fixed_t *vx, wl_fixed_t *vy)
 {
-	struct weston_view *view;
 	wl_fixed_t view_x, view_y;
 	int view_ix, view_iy;
-	int ix = wl_fixed_to_int(x);
-	int iy = wl_fixed_to_int(y);
 
+	if (!pixman_region32_contains_point(&view->transform.boundingbox,
+					    wl_fixed_to_int(x),
+					    wl_fixed_to_int(y), NULL))
+		return false;
+
+	weston_view_from_global_fixed(view, x, y, &view_x, &view_y);
+	view_ix = wl_fixed_to_int(view_x);
+	view_iy = wl_fixed_to_int(view_y);
+
+	if (!pixman_region32_contains_point(&view->surface->input,
+					    view_ix, view_iy, NULL))
+		return false;
+
+	if (view->geometry.scissor_enabled &&
+	    !pixman_region32_contains_point(&view->geometry.scissor,
+					    view_ix, view_iy, NULL))
+		return false;
+
+	*vx = view_x;
+	*vy = view_y;
+	return true;
+}
+
+static void
+pick_grid_cell_range(const struct pick_grid *grid, const pixman_box32_t *box,
+		     int *c0, int *c1, int *r0, int *r1)
+{
+	int x1 = box->x1 > grid->x ? box->x1 : grid->x;
+	int y1 = box->y1 > grid->y ? box->y1 : grid->y;
+	int x2 = box->x2 < grid->x + grid->width ?
+		 box->x2 : grid->x + grid->width;
+	int y2 = box->y2 < grid->y + grid->height ?
+		 box->y2 : grid->y + grid->height;
+
+	if (x1 >= x2 || y1 >= y2) {
+		*c0 = *r0 = 0;
+		*c1 = *r1 = -1;
+		return;
+	}
+
+	*c0 = (x1 - grid->x) / grid->cell_width;
+	*c1 = (x2 - 1 - grid->x) / grid->cell_width;
+	*r0 = (y1 - grid->y) / grid->cell_height;
+	*r1 = (y2 - 1 - grid->y) / grid->cell_height;
+}
+
+static void
+pick_grid_build(struct pick_grid *grid, struct weston_output *output)
+{
+	struct weston_compositor *compositor = output->compositor;
+	pixman_box32_t *extents = pixman_region32_extents(&output->region);
+	uint32_t fill[PICK_GRID_CELLS];
+	struct weston_view **views;
+	struct weston_view *view;
+	int c, c0, c1, r, r0, r1, i;
+
+	grid->valid = false;
+	grid->generation = pick_index.generation;
+	grid->x = extents->x1;
+	grid->y = extents->y1;
+	grid->width = extents->x2 - extents->x1;
+	grid->height = extents->y2 - extents->y1;
+	if (grid->width <= 0 || grid->height <= 0)
+		return;
+	grid->cell_width = (grid->width + PICK_GRID_DIM - 1) / PICK_GRID_DIM;
+	grid->cell_height = (grid->height + PICK_GRID_DIM - 1) / PICK_GRID_DIM;
+
+	/* Count the views over each cell, then place them in view list
+	 * order, so that each cell lists the topmost view first. */
+	memset(grid->start, 0, sizeof grid->start);
 	wl_list_for_each(view, &compositor->view_list, link) {
-		if (!pixman_region32_contains_point(
-				&view->transform.boundingbox, ix, iy, NULL))
-			continue;
+		pick_grid_cell_range(grid,
+			pixman_region32_extents(&view->transform.boundingbox),
+			&c0, &c1, &r0, &r1);
+		for (r = r0; r <= r1; r++)
+			for (c = c0; c <= c1; c++)
+				grid->start[r * PICK_GRID_DIM + c + 1]++;
+	}
 
-		weston_view_from_global_fixed(view, x, y, &view_x, &view_y);
-		view_ix = wl_fixed_to_int(view_x);
-		view_iy = wl_fixed_to_int(view_y);
+	for (i = 0; i < PICK_GRID_CELLS; i++) {
+		grid->start[i + 1] += grid->start[i];
+		fill[i] = grid->start[i];
+	}
 
-		if (!pixman_region32_contains_point(&view->surface->input,
-						    view_ix, view_iy, NULL))
-			continue;
+	if (grid->start[PICK_GRID_CELLS] > grid->size) {
+		views = realloc(grid->views, grid->start[PICK_GRID_CELLS] *
+					     sizeof *views);
+		if (!views)
+			return;
+		grid->views = views;
+		grid->size = grid->start[PICK_GRID_CELLS];
+	}
+
+	wl_list_for_each(view, &compositor->view_list, link) {
+		pick_grid_cell_range(grid,
+			pixman_region32_extents(&view->transform.boundingbox),
+			&c0, &c1, &r0, &r1);
+		for (r = r0; r <= r1; r++)
+			for (c = c0; c <= c1; c++)
+				grid->views[fill[r * PICK_GRID_DIM + c]++] = view;
+	}
+
+	grid->valid = true;
+}
 
-		if (view->geometry.scissor_enabled &&
-		    !pixman_region32_contains_point(&view->geometry.scissor,
-						    view_ix, view_iy, NULL))
+/* Find the grid of the output containing a point, building the index
+ * first if it is out of date.  Returns NULL if no output contains the
+ * point or its grid could not be built.
+ */
+static struct pick_grid *
+pick_index_find_grid(struct weston_compositor *compositor, int x, int y)
+{
+	struct weston_output *output;
+	struct pick_grid *grid;
+	pixman_box32_t *extents;
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		if (!pixman_region32_contains_point(&output->region,
+						    x, y, NULL))
 			continue;
 
-		*vx = view_x;
-		*vy = view_y;
-		return view;
+		grid = &pick_index.grids[output->id];
+		extents = pixman_region32_extents(&output->region);
+		if (grid->generation != pick_index.generation ||
+		    grid->x != extents->x1 || grid->y != extents->y1 ||
+		    grid->width != extents->x2 - extents->x1 ||
+		    grid->height != extents->y2 - extents->y1)
+			pick_grid_build(grid, output);
+
+		return grid->valid ? grid : NULL;
+	}
+
+	return NULL;
+}
+
+WL_EXPORT struct weston_view *
+weston_compositor_pick_view(struct weston_compositor *compositor,
+			    wl_fixed_t x, wl_fixed_t y,
+			    wl_fixed_t *vx, wl_fixed_t *vy)
+{
+	struct weston_view *view;
+	struct pick_grid *grid;
+	int ix = wl_fixed_to_int(x);
+	int iy = wl_fixed_to_int(y);
+	uint32_t cell, i;
+
+	grid = pick_index_find_grid(compositor, ix, iy);
+	if (grid) {
+		cell = (iy - grid->y) / grid->cell_height * PICK_GRID_DIM +
+		       (ix - grid->x) / grid->cell_width;
+		for (i = grid->start[cell]; i < grid->start[cell + 1]; i++) {
+			view = grid->views[i];
+			if (weston_view_accepts_input_at(view, x, y, vx, vy))
+				return view;
+		}
+	} else {
+		wl_list_for_each(view, &compositor->view_list, link) {
+			if (weston_view_accepts_input_at(view, x, y, vx, vy))
+				return view;
+		}
 	}
 
 	*vx = wl_fixed_from_int(-1000000);
@@ -1870,6 +2178,7 @@ weston_view_unmap(struct weston_view *view)
 	weston_layer_entry_remove(&view->layer_link);
 	wl_list_remove(&view->link);
 	wl_list_init(&view->link);
+	pick_index_invalidate();
 	view->output_mask = 0;
 	weston_surface_assign_output(view->surface);
 
@@ -1899,6 +2208,7 @@ weston_surface_unmap(struct weston_surface *surface)
 	wl_list_for_each(view, &surface->views, surface_link)
 		weston_view_unmap(view);
 	surface->output = NULL;
+	view_list_set_dirty();
 }
 
 static void
@@ -1925,6 +2235,7 @@ weston_view_destroy(struct weston_view *view)
 
 	wl_list_remove(&view->link);
 	weston_layer_entry_remove(&view->layer_link);
+	pick_index_invalidate();
 
 	pixman_region32_fini(&view->clip);
 	pixman_region32_fini(&view->geometry.scissor);
@@ -1987,14 +2298,124 @@ destroy_surface(struct wl_resource *resource)
 	weston_surface_destroy(surface);
 }
 
+/* wl_buffer.release events are held back and sent once per frame, when
+ * a repaint finishes, or at the end of the current dispatch if no repaint
+ * is scheduled.  A buffer that is referenced again in the meantime is not
+ * released at all.  The weston_buffer for a wl_resource is found through
+ * its destroy listener; freed ones are kept in a small pool, for clients
+ * that create a new wl_buffer every frame.
+ */
+#define BUFFER_POOL_SIZE 16
+
+static struct {
+	struct weston_compositor *compositor;
+	struct weston_buffer **pending;
+	int count;
+	int size;
+	struct wl_event_source *idle;
+	struct weston_buffer *pool[BUFFER_POOL_SIZE];
+	int pool_count;
+} buffer_cache;
+
+static void
+weston_buffer_flush_releases(void)
+{
+	struct weston_buffer *buffer;
+	int i;
+
+	if (buffer_cache.idle) {
+		wl_event_source_remove(buffer_cache.idle);
+		buffer_cache.idle = NULL;
+	}
+
+	for (i = 0; i < buffer_cache.count; i++) {
+		buffer = buffer_cache.pending[i];
+		if (buffer->busy_count == 0)
+			wl_resource_queue_event(buffer->resource,
+						WL_BUFFER_RELEASE);
+	}
+	buffer_cache.count = 0;
+}
+
+static void
+buffer_release_idle_handler(void *data)
+{
+	buffer_cache.idle = NULL;
+	weston_buffer_flush_releases();
+}
+
+static void
+weston_buffer_queue_release(struct weston_buffer *buffer)
+{
+	struct weston_compositor *compositor = buffer_cache.compositor;
+	struct weston_buffer **pending;
+	struct weston_output *output;
+	struct wl_event_loop *loop;
+	int i, size;
+
+	/* Nothing flushes the queue once the compositor is shut down. */
+	if (!compositor) {
+		wl_resource_queue_event(buffer->resource, WL_BUFFER_RELEASE);
+		return;
+	}
+
+	for (i = 0; i < buffer_cache.count; i++)
+		if (buffer_cache.pending[i] == buffer)
+			return;
+
+	if (buffer_cache.count == buffer_cache.size) {
+		size = buffer_cache.size ? buffer_cache.size * 2 : 16;
+		pending = realloc(buffer_cache.pending, size * sizeof *pending);
+		if (!pending) {
+			wl_resource_queue_event(buffer->resource,
+						WL_BUFFER_RELEASE);
+			return;
+		}
+		buffer_cache.pending = pending;
+		buffer_cache.size = size;
+	}
+	buffer_cache.pending[buffer_cache.count++] = buffer;
+
+	if (buffer_cache.idle)
+		return;
+
+	/* A scheduled repaint flushes the releases when it is done, or
+	 * when it finds there is nothing to do. */
+	wl_list_for_each(output, &compositor->output_list, link)
+		if (output->repaint_scheduled)
+			return;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	buffer_cache.idle = wl_event_loop_add_idle(loop,
+						   buffer_release_idle_handler,
+						   NULL);
+	if (!buffer_cache.idle)
+		weston_buffer_flush_releases();
+}
+
 static void
 weston_buffer_destroy_handler(struct wl_listener *listener, void *data)
 {
 	struct weston_buffer *buffer =
 		container_of(listener, struct weston_buffer, destroy_listener);
+	int i;
 
 	wl_signal_emit(&buffer->destroy_signal, buffer);
-	free(buffer);
+
+	for (i = 0; i < buffer_cache.count; i++) {
+		if (buffer_cache.pending[i] == buffer) {
+			buffer_cache.pending[i] =
+				buffer_cache.pending[--buffer_cache.count];
+			break;
+		}
+	}
+
+	/* After shutdown the pool would never be freed again. */
+	if (buffer_cache.compositor &&
+	    buffer_cache.pool_count < BUFFER_POOL_SIZE)
+		buffer_cache.pool[buffer_cache.pool_count++] = buffer;
+	else
+		free(buffer);
 }
 
 WL_EXPORT struct weston_buffer *
@@ -2010,9 +2431,14 @@ weston_buffer_from_resource(struct wl_resource *resource)
 		return container_of(listener, struct weston_buffer,
 				    destroy_listener);
 
-	buffer = zalloc(sizeof *buffer);
-	if (buffer == NULL)
-		return NULL;
+	if (buffer_cache.pool_count > 0) {
+		buffer = buffer_cache.pool[--buffer_cache.pool_count];
+		memset(buffer, 0, sizeof *buffer);
+	} else {
+		buffer = zalloc(sizeof *buffer);
+		if (buffer == NULL)
+			return NULL;
+	}
 
 	buffer->resource = resource;
 	wl_signal_init(&buffer->destroy_signal);
@@ -2043,8 +2469,7 @@ weston_buffer_reference(struct weston_buffer_reference *ref,
 		ref->buffer->busy_count--;
 		if (ref->buffer->busy_count == 0) {
 			assert(wl_resource_get_client(ref->buffer->resource));
-			wl_resource_queue_event(ref->buffer->resource,
-						WL_BUFFER_RELEASE);
+			weston_buffer_queue_release(ref->buffer);
 		}
 		wl_list_remove(&ref->destroy_listener.link);
 	}
@@ -2291,11 +2716,44 @@ view_list_add(struct weston_compositor *compositor,
 	}
 }
 
+static bool
+view_list_needs_rebuild(struct weston_compositor *compositor)
+{
+	struct weston_layer *layer;
+	int i = 0;
+
+	if (view_list_state.dirty || view_list_state.num_layers < 0)
+		return true;
+
+	wl_list_for_each(layer, &compositor->layer_list, link) {
+		if (i == view_list_state.num_layers ||
+		    view_list_state.layers[i] != layer)
+			return true;
+		i++;
+	}
+
+	return i != view_list_state.num_layers;
+}
+
 static void
 weston_compositor_build_view_list(struct weston_compositor *compositor)
 {
 	struct weston_view *view;
 	struct weston_layer *layer;
+	int i = 0;
+
+	/* Cleared first, as updating the transforms below may map or
+	 * unmap sub-surfaces, which needs another pass next time. */
+	view_list_state.dirty = false;
+	wl_list_for_each(layer, &compositor->layer_list, link) {
+		if (i == VIEW_LIST_MAX_LAYERS) {
+			i = -1;
+			break;
+		}
+		view_list_state.layers[i++] = layer;
+	}
+	view_list_state.num_layers = i;
+	pick_index_invalidate();
 
 	wl_list_for_each(layer, &compositor->layer_list, link)
 		wl_list_for_each(view, &layer->view_list.link, layer_link.link)
@@ -2313,6 +2771,23 @@ weston_compositor_build_view_list(struct weston_compositor *compositor)
 			surface_free_unused_subsurface_views(view->surface);
 }
 
+/* Bring compositor->view_list up to date for a repaint, rebuilding it only
+ * if the scene graph changed.  Transforms are updated either way.
+ */
+static void
+weston_compositor_update_view_list(struct weston_compositor *compositor)
+{
+	struct weston_view *view;
+
+	if (view_list_needs_rebuild(compositor)) {
+		weston_compositor_build_view_list(compositor);
+		return;
+	}
+
+	wl_list_for_each(view, &compositor->view_list, link)
+		weston_view_update_transform(view);
+}
+
 static void
 weston_output_take_feedback_list(struct weston_output *output,
 				 struct weston_surface *surface)
@@ -2338,6 +2813,199 @@ weston_output_take_feedback_list(struct weston_output *output,
 	wl_list_init(&surface->feedback_list);
 }
 
+/* Adaptive repaint window.  By default repaint starts repaint_msec before
+ * the predicted vblank.  With WESTON_REPAINT_ADAPTIVE set, the window is
+ * instead the longest of the output's recent repaints, from
+ * core_repaint_begin to core_repaint_posted, plus a safety margin.  The
+ * margin is in milliseconds and taken from the variable's value, 1 by
+ * default.  repaint_msec remains the upper bound, so repaint starts as
+ * late as recent frames allow, but never earlier than configured.
+ */
+#define REPAINT_HISTORY_SIZE 32
+#define REPAINT_HISTORY_MIN 8
+
+struct repaint_history {
+	int64_t nsec[REPAINT_HISTORY_SIZE];
+	unsigned int count;
+	unsigned int next;
+};
+
+static bool repaint_adaptive_enabled;
+static int repaint_adaptive_margin_msec = 1;
+static struct repaint_history repaint_history[32];
+
+static void
+repaint_history_add(struct weston_output *output,
+		    const struct timespec *begin, const struct timespec *end)
+{
+	struct repaint_history *history = &repaint_history[output->id];
+	struct timespec span;
+
+	timespec_sub(&span, end, begin);
+	history->nsec[history->next] = timespec_to_nsec(&span);
+	history->next = (history->next + 1) % REPAINT_HISTORY_SIZE;
+	if (history->count < REPAINT_HISTORY_SIZE)
+		history->count++;
+}
+
+static int
+weston_output_repaint_window(struct weston_output *output)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct repaint_history *history = &repaint_history[output->id];
+	int64_t worst = 0;
+	unsigned int i;
+	int msec;
+
+	if (!repaint_adaptive_enabled || history->count < REPAINT_HISTORY_MIN)
+		return compositor->repaint_msec;
+
+	for (i = 0; i < history->count; i++)
+		if (history->nsec[i] > worst)
+			worst = history->nsec[i];
+
+	msec = (worst + 999999) / 1000000 + repaint_adaptive_margin_msec;
+	if (msec > compositor->repaint_msec)
+		msec = compositor->repaint_msec;
+
+	return msec;
+}
+
+/* Repaint instrumentation.  While enabled, with the debug binding or
+ * WESTON_REPAINT_STATS in the environment, every repaint is timed and its
+ * damage, view count and plane assignment recorded.  Each output reports
+ * a summary once per REPAINT_STATS_PERIOD, and every frame that takes
+ * longer than the repaint window, and so probably misses its vblank, is
+ * logged on its own.  Outputs are kept apart by their id, which is
+ * limited to 32 by output_id_pool.
+ */
+#define REPAINT_STATS_PERIOD 1000 /* milliseconds */
+
+struct repaint_stats {
+	struct timespec period_start;
+	uint32_t frames;
+	uint32_t late_frames;
+	int64_t repaint_nsec;
+	int64_t repaint_max_nsec;
+	uint64_t damage_area;
+	uint32_t views;
+	uint32_t plane_views;
+};
+
+struct repaint_frame {
+	struct timespec begin;
+	struct timespec planes_assigned;
+	struct timespec damage_accumulated;
+	struct timespec end;
+	uint32_t views;		/* views on the output */
+	uint32_t plane_views;	/* those not on the primary plane */
+	uint32_t damage_area;
+};
+
+static bool repaint_stats_enabled;
+static struct repaint_stats repaint_stats[32];
+
+static void
+repaint_stats_reset(void)
+{
+	memset(repaint_stats, 0, sizeof repaint_stats);
+}
+
+static void
+repaint_stats_stamp(struct weston_compositor *compositor,
+		    struct timespec *ts)
+{
+	if (repaint_stats_enabled)
+		weston_compositor_read_presentation_clock(compositor, ts);
+}
+
+static uint32_t
+repaint_stats_region_area(pixman_region32_t *region)
+{
+	pixman_box32_t *rects;
+	uint32_t area = 0;
+	int i, n;
+
+	rects = pixman_region32_rectangles(region, &n);
+	for (i = 0; i < n; i++)
+		area += (rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+
+	return area;
+}
+
+static double
+repaint_stats_span_msec(const struct timespec *a, const struct timespec *b)
+{
+	struct timespec d;
+
+	timespec_sub(&d, b, a);
+	return timespec_to_nsec(&d) / 1000000.0;
+}
+
+static void
+repaint_stats_report(struct weston_output *output,
+		     const struct repaint_frame *frame)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct repaint_stats *stats = &repaint_stats[output->id];
+	uint32_t output_area = output->width * output->height;
+	struct timespec span;
+	int64_t nsec;
+
+	timespec_sub(&span, &frame->end, &frame->begin);
+	nsec = timespec_to_nsec(&span);
+
+	if (stats->frames == 0 && stats->period_start.tv_sec == 0)
+		stats->period_start = frame->begin;
+
+	stats->frames++;
+	stats->repaint_nsec += nsec;
+	if (nsec > stats->repaint_max_nsec)
+		stats->repaint_max_nsec = nsec;
+	stats->damage_area += frame->damage_area;
+	stats->views += frame->views;
+	stats->plane_views += frame->plane_views;
+
+	if (nsec > weston_output_repaint_window(output) * 1000000LL) {
+		stats->late_frames++;
+		weston_log("repaint: output %s frame took %.2f ms "
+			   "(planes %.2f, damage %.2f, render %.2f), "
+			   "window %d ms, damage %u px, "
+			   "%u views, %u on planes\n",
+			   output->name, nsec / 1000000.0,
+			   repaint_stats_span_msec(&frame->begin,
+						   &frame->planes_assigned),
+			   repaint_stats_span_msec(&frame->planes_assigned,
+						   &frame->damage_accumulated),
+			   repaint_stats_span_msec(&frame->damage_accumulated,
+						   &frame->end),
+			   weston_output_repaint_window(output),
+			   frame->damage_area,
+			   frame->views, frame->plane_views);
+	}
+
+	timespec_sub(&span, &frame->end, &stats->period_start);
+	if (timespec_to_nsec(&span) < REPAINT_STATS_PERIOD * 1000000LL)
+		return;
+
+	weston_log("repaint: output %s: %u frames, %u late, "
+		   "latency avg %.2f max %.2f ms, "
+		   "damage avg %llu px (%.1f%%), "
+		   "views avg %.1f, %.1f on planes\n",
+		   output->name, stats->frames, stats->late_frames,
+		   stats->repaint_nsec / 1000000.0 / stats->frames,
+		   stats->repaint_max_nsec / 1000000.0,
+		   (unsigned long long) (stats->damage_area / stats->frames),
+		   output_area ? 100.0 * stats->damage_area /
+				 stats->frames / output_area : 0.0,
+		   (double) stats->views / stats->frames,
+		   (double) stats->plane_views / stats->frames);
+
+	memset(stats, 0, sizeof *stats);
+	stats->period_start = frame->end;
+}
+
 static int
 weston_output_repaint(struct weston_output *output)
 {
@@ -2347,15 +3015,20 @@ weston_output_repaint(struct weston_output *output)
 	struct weston_frame_callback *cb, *cnext;
 	struct wl_list frame_callback_list;
 	pixman_region32_t output_damage;
+	struct repaint_frame frame = { { 0 } };
+	struct timespec begin = { 0 }, posted;
 	int r;
 
 	if (output->destroying)
 		return 0;
 
 	TL_POINT("core_repaint_begin", TLP_OUTPUT(output), TLP_END);
+	repaint_stats_stamp(ec, &frame.begin);
+	if (repaint_adaptive_enabled)
+		weston_compositor_read_presentation_clock(ec, &begin);
 
-	/* Rebuild the surface list and update surface transforms up front. */
-	weston_compositor_build_view_list(ec);
+	/* Update the surface list and surface transforms up front. */
+	weston_compositor_update_view_list(ec);
 
 	if (output->assign_planes && !output->disable_planes) {
 		output->assign_planes(output);
@@ -2365,9 +3038,17 @@ weston_output_repaint(struct weston_output *output)
 			ev->psf_flags = 0;
 		}
 	}
+	repaint_stats_stamp(ec, &frame.planes_assigned);
 
 	wl_list_init(&frame_callback_list);
 	wl_list_for_each(ev, &ec->view_list, link) {
+		if (repaint_stats_enabled &&
+		    ev->output_mask & (1u << output->id)) {
+			frame.views++;
+			if (ev->plane != &ec->primary_plane)
+				frame.plane_views++;
+		}
+
 		/* Note: This operation is safe to do multiple times on the
 		 * same surface.
 		 */
@@ -2387,12 +3068,19 @@ weston_output_repaint(struct weston_output *output)
 				  &ec->primary_plane.damage, &output->region);
 	pixman_region32_subtract(&output_damage,
 				 &output_damage, &ec->primary_plane.clip);
+	repaint_stats_stamp(ec, &frame.damage_accumulated);
 
 	if (output->dirty)
 		weston_output_update_matrix(output);
 
 	r = output->repaint(output, &output_damage);
 
+	if (repaint_stats_enabled) {
+		frame.damage_area = repaint_stats_region_area(&output_damage);
+		weston_compositor_read_presentation_clock(ec, &frame.end);
+		repaint_stats_report(output, &frame);
+	}
+
 	pixman_region32_fini(&output_damage);
 
 	output->repaint_needed = 0;
@@ -2409,7 +3097,13 @@ weston_output_repaint(struct weston_output *output)
 		animation->frame(animation, output, output->frame_time);
 	}
 
+	weston_buffer_flush_releases();
+
 	TL_POINT("core_repaint_posted", TLP_OUTPUT(output), TLP_END);
+	if (repaint_adaptive_enabled) {
+		weston_compositor_read_presentation_clock(ec, &posted);
+		repaint_history_add(output, &begin, &posted);
+	}
 
 	return r;
 }
@@ -2418,6 +3112,7 @@ static void
 weston_output_schedule_repaint_reset(struct weston_output *output)
 {
 	output->repaint_scheduled = 0;
+	weston_buffer_flush_releases();
 	TL_POINT("core_repaint_exit_loop", TLP_OUTPUT(output), TLP_END);
 }
 
@@ -2463,7 +3158,7 @@ weston_output_finish_frame(struct weston_output *output,
 	weston_compositor_read_presentation_clock(compositor, &now);
 	timespec_sub(&gone, &now, stamp);
 	msec = (refresh_nsec - timespec_to_nsec(&gone)) / 1000000; /* floor */
-	msec -= compositor->repaint_msec;
+	msec -= weston_output_repaint_window(output);
 
 	if (msec < -1000 || msec > 1000) {
 		static bool warned;
@@ -2503,6 +3198,7 @@ weston_layer_entry_insert(struct weston_layer_entry *list,
 {
 	wl_list_insert(&list->link, &entry->link);
 	entry->layer = list->layer;
+	view_list_set_dirty();
 }
 
 WL_EXPORT void
@@ -2511,6 +3207,7 @@ weston_layer_entry_remove(struct weston_layer_entry *entry)
 	wl_list_remove(&entry->link);
 	wl_list_init(&entry->link);
 	entry->layer = NULL;
+	view_list_set_dirty();
 }
 
 WL_EXPORT void
@@ -2710,11 +3407,36 @@ surface_set_input_region(struct wl_client *client,
 	}
 }
 
+static bool
+weston_surface_subsurface_order_changed(struct weston_surface *surface)
+{
+	struct wl_list *link = surface->subsurface_list.next;
+	struct wl_list *pending = surface->subsurface_list_pending.next;
+
+	while (link != &surface->subsurface_list &&
+	       pending != &surface->subsurface_list_pending) {
+		if (container_of(link, struct weston_subsurface, parent_link) !=
+		    container_of(pending, struct weston_subsurface,
+				 parent_link_pending))
+			return true;
+
+		link = link->next;
+		pending = pending->next;
+	}
+
+	return link != &surface->subsurface_list ||
+	       pending != &surface->subsurface_list_pending;
+}
+
 static void
 weston_surface_commit_subsurface_order(struct weston_surface *surface)
 {
 	struct weston_subsurface *sub;
 
+	if (!weston_surface_subsurface_order_changed(surface))
+		return;
+
+	view_list_set_dirty();
 	wl_list_for_each_reverse(sub, &surface->subsurface_list_pending,
 				 parent_link_pending) {
 		wl_list_remove(&sub->parent_link);
@@ -3293,6 +4015,7 @@ subsurface_configure(struct weston_surface *surface, int32_t dx, int32_t dy)
 
 		surface->output = output;
 		weston_surface_update_output_mask(surface, 1u << output->id);
+		view_list_set_dirty();
 	}
 }
 
@@ -3583,6 +4306,7 @@ weston_subsurface_unlink_parent(struct weston_subsurface *sub)
 	wl_list_remove(&sub->parent_link_pending);
 	wl_list_remove(&sub->parent_destroy_listener.link);
 	sub->parent = NULL;
+	view_list_set_dirty();
 }
 
 static void
@@ -3645,6 +4369,7 @@ weston_subsurface_link_parent(struct weston_subsurface *sub,
 	wl_list_insert(&parent->subsurface_list, &sub->parent_link);
 	wl_list_insert(&parent->subsurface_list_pending,
 		       &sub->parent_link_pending);
+	view_list_set_dirty();
 }
 
 static void
@@ -3689,6 +4414,7 @@ weston_subsurface_destroy(struct weston_subsurface *sub)
 		assert(sub->parent_destroy_listener.notify == NULL);
 		wl_list_remove(&sub->parent_link);
 		wl_list_remove(&sub->parent_link_pending);
+		view_list_set_dirty();
 	}
 
 	wl_list_remove(&sub->surface_destroy_listener.link);
@@ -3753,6 +4479,7 @@ weston_subsurface_create_for_parent(struct weston_surface *parent)
 	wl_list_insert(&parent->subsurface_list, &sub->parent_link);
 	wl_list_insert(&parent->subsurface_list_pending,
 		       &sub->parent_link_pending);
+	view_list_set_dirty();
 
 	return sub;
 }
@@ -4100,6 +4827,7 @@ weston_output_destroy(struct weston_output *output)
 	wl_event_source_remove(output->repaint_timer);
 
 	weston_presentation_feedback_discard_list(&output->feedback_list);
+	weston_buffer_flush_releases();
 
 	weston_compositor_remove_output(output->compositor, output);
 	wl_list_remove(&output->link);
@@ -4107,6 +4835,9 @@ weston_output_destroy(struct weston_output *output)
 	wl_signal_emit(&output->compositor->output_destroyed_signal, output);
 	wl_signal_emit(&output->destroy_signal, output);
 
+	free(pick_index.grids[output->id].views);
+	memset(&pick_index.grids[output->id], 0, sizeof pick_index.grids[0]);
+
 	free(output->name);
 	pixman_region32_fini(&output->region);
 	pixman_region32_fini(&output->previous_damage);
@@ -4305,6 +5036,8 @@ weston_output_init(struct weston_output *output, struct weston_compositor *c,
 	 */
 	output->id = ffs(~output->compositor->output_id_pool) - 1;
 	output->compositor->output_id_pool |= 1u << output->id;
+	memset(&repaint_stats[output->id], 0, sizeof repaint_stats[0]);
+	memset(&repaint_history[output->id], 0, sizeof repaint_history[0]);
 
 	output->global =
 		wl_global_create(c->wl_display, &wl_output_interface, 2,
@@ -4669,6 +5402,17 @@ timeline_key_binding_handler(struct weston_keyboard *keyboard, uint32_t time,
 		weston_timeline_open(compositor);
 }
 
+static void
+repaint_stats_key_binding_handler(struct weston_keyboard *keyboard,
+				  uint32_t time, uint32_t key, void *data)
+{
+	repaint_stats_enabled = !repaint_stats_enabled;
+	repaint_stats_reset();
+
+	weston_log("repaint statistics %s\n",
+		   repaint_stats_enabled ? "enabled" : "disabled");
+}
+
 /** Create the compositor.
  *
  * This functions creates and initializes a compositor instance.
@@ -4683,6 +5427,8 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 {
 	struct weston_compositor *ec;
 	struct wl_event_loop *loop;
+	char *adaptive, *end;
+	long margin;
 
 	ec = zalloc(sizeof *ec);
 	if (!ec)
@@ -4709,6 +5455,7 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 
 	ec->output_id_pool = 0;
 	ec->repaint_msec = DEFAULT_REPAINT_WINDOW;
+	buffer_cache.compositor = ec;
 
 	if (!wl_global_create(ec->wl_display, &wl_compositor_interface, 4,
 			      ec, compositor_bind))
@@ -4737,6 +5484,7 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 	wl_list_init(&ec->touch_binding_list);
 	wl_list_init(&ec->axis_binding_list);
 	wl_list_init(&ec->debug_binding_list);
+	view_list_set_dirty();
 
 	weston_plane_init(&ec->primary_plane, ec, 0, 0);
 	weston_compositor_stack_plane(ec, &ec->primary_plane, NULL);
@@ -4753,6 +5501,21 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 
 	weston_compositor_add_debug_binding(ec, KEY_T,
 					    timeline_key_binding_handler, ec);
+	weston_compositor_add_debug_binding(ec, KEY_P,
+					    repaint_stats_key_binding_handler,
+					    ec);
+
+	if (getenv("WESTON_REPAINT_STATS"))
+		repaint_stats_enabled = true;
+
+	adaptive = getenv("WESTON_REPAINT_ADAPTIVE");
+	if (adaptive) {
+		repaint_adaptive_enabled = true;
+		margin = strtol(adaptive, &end, 0);
+		if (*adaptive != '\0' && *end == '\0' &&
+		    margin >= 0 && margin < 1000)
+			repaint_adaptive_margin_msec = margin;
+	}
 
 	return ec;
 
@@ -4783,6 +5546,12 @@ weston_compositor_shutdown(struct weston_compositor *ec)
 	weston_binding_list_destroy_all(&ec->debug_binding_list);
 
 	weston_plane_release(&ec->primary_plane);
+
+	weston_buffer_flush_releases();
+	free(buffer_cache.pending);
+	while (buffer_cache.pool_count > 0)
+		free(buffer_cache.pool[--buffer_cache.pool_count]);
+	memset(&buffer_cache, 0, sizeof buffer_cache);
 }
 
 WL_EXPORT void